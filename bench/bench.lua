@@ -0,0 +1,311 @@
+--[[
+bench.lua - timings of the binding hot paths
+
+usage: lua bench/bench.lua [iterations]
+
+Runs curses headless (see curses.init_headless) and prints one JSON
+object per case, with:
+
+    ns_per_op           wall time per operation
+    gc_bytes_per_op     Lua heap allocated per operation
+    scratch_allocs      growths of the shared scratch buffer during the case
+    bytes_per_frame     terminal output per frame, for cases that update
+                        the screen
+    composed_per_frame  cells copied by window:compose per frame
+
+Run it from the top of the source tree, after building lcurses.so.
+]]
+
+os.setlocale('', 'all')
+
+local curses = require 'lcurses'
+package.loaded.curses = curses
+
+local ITERS = tonumber(arg and arg[1]) or 20000
+local LINES, COLS = 24, 80
+
+local clock = os.clock
+local format = string.format
+
+local ascii = 'CPU 12.5%  MEM 2048/8192 MB  LOAD 0.42 0.37 0.31  uptime 12 days'
+local cjk = '你好世界中文支持给你一张过去的窗口你好世界中文支持'
+
+-- run fn(i) iters times and print the JSON line for the case
+local function bench(name, iters, fn, frames)
+    fn(0) -- warm up
+
+    local allocs = curses.scratch_stats()
+    local composed = select(4, curses.damage_stats())
+    if (frames) then
+        curses.headless_output()
+        curses.output_stats(true)
+    end
+
+    collectgarbage('collect')
+    collectgarbage('stop')
+    local mem = collectgarbage('count')
+    local t0 = clock()
+    for i = 1, iters do
+        fn(i)
+    end
+    local t = clock() - t0
+    local gc = (collectgarbage('count') - mem) * 1024
+    collectgarbage('restart')
+
+    local line = format('{"bench":"%s","ops":%d,"ns_per_op":%.1f,' ..
+        '"gc_bytes_per_op":%.1f,"scratch_allocs":%d',
+        name, iters, t * 1e9 / iters, gc / iters,
+        curses.scratch_stats() - allocs)
+    if (frames) then
+        local _, _, escapes, moves = curses.output_stats()
+        line = line .. format(',"bytes_per_frame":%.1f' ..
+            ',"escapes_per_frame":%.1f,"moves_per_frame":%.1f' ..
+            ',"composed_per_frame":%.1f', #curses.headless_output() / iters,
+            escapes / iters, moves / iters,
+            (select(4, curses.damage_stats()) - composed) / iters)
+    end
+    print(line .. '}')
+end
+
+local function core()
+    local w = curses.main_window()
+    local cs = curses.new_chstr(COLS)
+    local pad = curses.new_pad(LINES, COLS)
+
+    -- addstr leaves the cursor in place, so every call draws the same cells
+    w:move(0, 0)
+    bench('waddnstr_ascii', ITERS, function()
+        w:addstr(ascii)
+    end)
+
+    w:move(1, 0)
+    bench('waddnstr_cjk', ITERS, function()
+        w:addstr(cjk)
+    end)
+
+    bench('mvwaddnstr_ascii', ITERS, function()
+        w:mvaddstr(0, 0, ascii)
+    end)
+
+    bench('chstr_set_str', ITERS, function()
+        cs:set_str(0, ascii, curses.A_BOLD)
+    end)
+
+    bench('mvaddchstr', ITERS, function()
+        w:mvaddchstr(2, 0, cs)
+    end)
+
+    -- a status line drawn per redraw: a new chstr each time, against one
+    -- kept and cleared as tview:line_buffer does
+    bench('chstr_line_new', ITERS, function()
+        local line = curses.new_chstr(COLS)
+        line:set_str(0, ascii, curses.A_BOLD)
+        w:mvaddchstr(3, 0, line)
+    end)
+    bench('chstr_line_reuse', ITERS, function()
+        cs:resize(COLS)
+        cs:clear()
+        cs:set_str(0, ascii, curses.A_BOLD)
+        w:mvaddchstr(3, 0, cs)
+    end)
+
+    for y = 0, LINES - 1 do pad:mvaddstr(y, 0, ascii) end
+    bench('copywin', ITERS / 10, function()
+        pad:copy(w, 0, 0, 0, 0, LINES - 1, COLS - 1)
+    end)
+
+    -- read back the whole pad: one cells copy, against a winch per cell
+    local grid = pad:cells(0, 0, LINES, COLS)
+    bench('cells_read', ITERS / 10, function()
+        grid:read(pad)
+    end)
+    bench('winch_scrape', ITERS / 100, function()
+        for y = 0, LINES - 1 do
+            for x = 0, COLS - 1 do
+                pad:mvwinch(y, x)
+            end
+        end
+    end)
+
+    local blob = pad:snapshot()
+    bench('snapshot', ITERS / 10, function()
+        pad:snapshot()
+    end)
+    bench('restore', ITERS / 10, function()
+        pad:restore(blob)
+    end)
+
+    -- a scroll bar down a tall list: one native call, against the cell
+    -- by cell loop tscrollbar used to run
+    local bar = curses.new_pad(200, 1)
+    bench('draw_scrollbar', ITERS, function(i)
+        bar:draw_scrollbar(true, 200, i % 1000 + 1, 1000, curses.A_REVERSE)
+    end)
+    bench('scrollbar_cells', ITERS / 10, function(i)
+        local pos = math.ceil(((i % 1000 + 1) * 198) / 1000)
+        bar:mvaddch(0, 0, curses.ACS_UARROW + curses.A_REVERSE)
+        for y = 1, 198 do
+            bar:mvaddch(y, 0, 32 + curses.A_REVERSE)
+            if (pos == y) then
+                bar:mvaddch(y, 0, string.byte('#') + curses.A_REVERSE)
+            end
+        end
+        bar:mvaddch(199, 0, curses.ACS_DARROW + curses.A_REVERSE)
+    end)
+    bar:close()
+
+    w:nodelay(true)
+    bench('getch_nodelay', ITERS, function()
+        w:getch()
+    end)
+
+    -- post and take with 256 events waiting, against the table.remove
+    -- queue it replaced
+    local q, t = curses.new_queue(), {}
+    for i = 1, 256 do
+        q:post(2, i)
+        t[i] = i
+    end
+    bench('event_queue', ITERS, function(i)
+        q:post(1, 2, i, nil)
+        q:take()
+    end)
+    bench('event_queue_table', ITERS, function(i)
+        table.insert(t, i)
+        table.remove(t, 1)
+    end)
+
+    -- a stack of panels, the bottom one moving every frame
+    local windows, panels = {}, {}
+    for i = 1, 3 do
+        windows[i] = curses.new_window(8, 30, i * 2, i * 4)
+        windows[i]:box(0, 0)
+        windows[i]:mvaddstr(1, 1, 'panel ' .. i)
+        panels[i] = curses.new_panel(windows[i])
+    end
+    bench('panel_update', ITERS / 20, function(i)
+        panels[1]:move(2 + i % 8, 4 + i % 30)
+        curses.update_panels()
+        curses.doupdate()
+    end, true)
+    for i = 3, 1, -1 do
+        panels[i]:close()
+        windows[i]:close()
+    end
+
+    -- a window manager stack: walk 128 panels and raise a few at once
+    for i = 1, 128 do
+        windows[i] = curses.new_window(4, 12, i % LINES, i % COLS)
+        panels[i] = curses.new_panel(windows[i])
+    end
+    bench('panels_walk', ITERS / 10, function()
+        for p in curses.panels(true) do
+            p:window()
+        end
+    end)
+    bench('panels_reorder', ITERS / 10, function(i)
+        curses.panels_reorder{ panels[1 + i % 128], panels[1 + (i * 7) % 128],
+            panels[1 + (i * 13) % 128] }
+    end)
+    for i = 128, 1, -1 do
+        panels[i]:close()
+        windows[i]:close()
+    end
+    curses.update_panels()
+
+    pad:close()
+    w:clear()
+    w:refresh()
+end
+
+local function cui_cycles()
+    require 'cui'
+    require 'cui/ctrls'
+
+    local benchapp = cui.class('benchapp', cui.tapp)
+
+    function benchapp:init_status_bar()
+        return cui.tstatusbar:new(cui.trect:new(0, self.size.y - 1, self.size.x, self.size.y),
+            {
+                { "AltX",       "Exit",         "ev_command",   "cm_quit",      true  },
+            }
+        )
+    end
+
+    local app = benchapp:new()
+    local r = cui.trect:new(1, 1, 27, 10)
+    for i = 1, 5 do
+        app.desktop:insert(cui.twindow:new(r, 'Window ' .. i, i))
+        r:move(2, 2)
+    end
+
+    app:show(true)
+    bench('cui_refresh', ITERS / 100, function()
+        app:refresh()
+    end, true)
+
+    -- one cell changing in a view at the bottom of nested windows
+    local cell = cui.class('cell', cui.tview)
+    function cell:cell(bounds)
+        self:tview(bounds)
+        self.n = 0
+    end
+    function cell:draw_window()
+        self:window():mvaddstr(0, self.n % self.size.x, tostring(self.n % 10))
+    end
+
+    local parent = app.desktop
+    for i = 1, 6 do
+        local w = cui.twindow:new(cui.trect:new(1, 1, 60 - 4 * i, 20 - 2 * i), 'Dialog ' .. i)
+        parent:insert(w)
+        parent = w
+    end
+    local leaf = cell:new(cui.trect:new(1, 1, parent.size.x - 1, 2))
+    parent:insert(leaf)
+
+    bench('cui_nested_cell', ITERS / 10, function(i)
+        leaf.n = i
+        leaf:draw_window()
+        leaf:redraw(true)
+    end, true)
+
+    -- scrolling a listbox over a million rows, one row per frame
+    local lw = cui.twindow:new(cui.trect:new(0, 1, COLS, LINES - 1), 'Log')
+    local lb = cui.tlistbox:new(cui.trect:new(1, 1, COLS - 1, LINES - 3), 1, { n = 1000000 })
+    function lb:get_strs(first, n, texts)
+        for k = 1, n do
+            texts[k] = format('%7d  %s', first + k - 1, ascii)
+        end
+    end
+    lw:insert(lb)
+    app.desktop:insert(lw)
+    bench('cui_listbox_scroll', ITERS / 10, function(i)
+        lb:set_position(i)
+        lb:refresh()
+    end, true)
+
+    -- inherited methods looked up through four levels of classes
+    bench('cui_method_lookup', ITERS * 10, function()
+        local _ = app.draw_window, app.handle_event, app.is_valid,
+            app.set_bounds
+    end)
+
+    -- a key nobody handles, through the desktop and its windows
+    local key = cui.tkeyboard_event:new(cui.tevent.ev_keyboard, 0, 'F20', false)
+    bench('cui_dispatch_key', ITERS, function()
+        key.type = cui.tevent.ev_keyboard
+        app:handle_event(key)
+    end)
+
+    -- dragging the terminal edge: every view changes bounds each frame
+    bench('cui_resize', ITERS / 100, function(i)
+        app:change_bounds(cui.trect:new(0, 0, COLS - i % 8, LINES - i % 4))
+        app:refresh()
+    end, true)
+
+    app:close()
+end
+
+curses.init_headless{ lines = LINES, cols = COLS }
+core()
+cui_cycles()
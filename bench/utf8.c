@@ -0,0 +1,154 @@
+/************************************************************************
+* Library   : lcurses - Lua 5 interface to the curses library           *
+* Benchmark : utf-8 decoding into cchar_t cells                         *
+*                                                                       *
+* Compares the native decoder used by chstr:set_str and window:addstr  *
+* with the previous implementation, which called utf8.codes through    *
+* the Lua stack once per codepoint. Both paths are checked to produce  *
+* identical cells before they are timed, and to reject the same        *
+* malformed input.                                                      *
+************************************************************************/
+
+/*
+** pull in the static functions of the binding. it comes first so that
+** its feature test macros are defined before any system header
+*/
+#include "lcurses.c"
+
+#include <stdio.h>
+#include <time.h>
+
+#include "lualib.h"
+
+#define CELLS   512
+
+/* the previous decoder: iterate utf8.codes from C */
+static int legacy_decode(lua_State *L, int index, cchar_t *out, attr_t attr)
+{
+    int i = 0;
+    int n = lua_gettop(L);
+    lua_getglobal(L, "utf8");
+    lua_getfield(L, -1, "codes");
+    lua_remove(L, -2);
+    lua_pushvalue(L, index);
+
+    lua_call(L, 1, LUA_MULTRET);
+    while (1) {
+        lua_pushvalue(L, -3);
+        lua_insert(L, -3);
+        lua_pushvalue(L, -2);
+        lua_insert(L, -4);
+
+        lua_call(L, 2, LUA_MULTRET);
+        if (lua_gettop(L) == n + 2) {
+            lua_pop(L, 2);
+            break;
+        } else {
+            out[i].chars[0] = lua_tointeger(L, -1);
+            out[i++].attr = attr;
+            lua_pop(L, 1);
+        }
+    }
+    return i;
+}
+
+/* legacy_decode(text, cells) under lua_pcall */
+static int legacy_call(lua_State *L)
+{
+    cchar_t *out = (cchar_t*)lua_touserdata(L, 2);
+    lua_pushinteger(L, legacy_decode(L, 1, out, A_NORMAL));
+    return 1;
+}
+
+/* malformed text: the native decoder fails where utf8.codes raises */
+static void reject(lua_State *L, const char *name, const char *text,
+                   size_t len)
+{
+    static cchar_t a[CELLS];
+    int native = lc_utf8_to_cchar(text, len, a, CELLS, A_NORMAL);
+    int legacy;
+
+    lua_pushcfunction(L, legacy_call);
+    lua_pushlstring(L, text, len);
+    lua_pushlightuserdata(L, a);
+    legacy = lua_pcall(L, 2, 1, 0);
+    lua_pop(L, 1);
+    if (native != -1 || legacy == LUA_OK) {
+        fprintf(stderr, "%s: decoders disagree (native %s, legacy %s)\n",
+                name, native == -1 ? "rejects" : "accepts",
+                legacy != LUA_OK ? "rejects" : "accepts");
+        exit(1);
+    }
+}
+
+#define REJECT(L, name, text)   reject(L, name, text, sizeof(text) - 1)
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void run(lua_State *L, const char *name, const char *text, long iters)
+{
+    static cchar_t a[CELLS], b[CELLS];
+    size_t len = strlen(text);
+    double t0, native, legacy;
+    int na, nb;
+    long k;
+
+    lua_pushstring(L, text);
+
+    /* check both paths produce the same cells */
+    memset(a, 0, sizeof(a));
+    memset(b, 0, sizeof(b));
+    na = lc_utf8_to_cchar(text, len, a, CELLS, A_BOLD);
+    nb = legacy_decode(L, lua_gettop(L), b, A_BOLD);
+    if (na != nb || memcmp(a, b, sizeof(a)) != 0) {
+        fprintf(stderr, "%s: decoders disagree (%d/%d cells)\n", name, na, nb);
+        exit(1);
+    }
+
+    t0 = now_ns();
+    for (k = 0; k < iters; k++)
+        lc_utf8_to_cchar(text, len, a, CELLS, A_NORMAL);
+    native = (now_ns() - t0) / iters;
+
+    t0 = now_ns();
+    for (k = 0; k < iters; k++)
+        legacy_decode(L, lua_gettop(L), b, A_NORMAL);
+    legacy = (now_ns() - t0) / iters;
+
+    lua_pop(L, 1);
+
+    printf("{\"bench\":\"utf8_decode\",\"case\":\"%s\",\"cells\":%d,"
+           "\"native_ns_per_op\":%.1f,\"legacy_ns_per_op\":%.1f,"
+           "\"speedup\":%.1f}\n", name, na, native, legacy, legacy / native);
+}
+
+int main(int argc, char **argv)
+{
+    long iters = argc > 1 ? atol(argv[1]) : 100000;
+    lua_State *L = luaL_newstate();
+    luaL_openlibs(L);
+
+    REJECT(L, "truncated_end", "ab\xE4\xBD");
+    REJECT(L, "truncated_mid", "\xE4\xBDx");
+    REJECT(L, "overlong_2", "\xC0\xAF");
+    REJECT(L, "overlong_3", "\xE0\x80\xAF");
+    REJECT(L, "overlong_4", "\xF0\x80\x80\xAF");
+    REJECT(L, "surrogate", "\xED\xA0\x80");
+    REJECT(L, "above_max", "\xF4\x90\x80\x80");
+    REJECT(L, "stray_first", "\x80" "abc");
+    REJECT(L, "stray_mid", "ab\x80" "cd");
+    REJECT(L, "invalid_in_ascii_run", "abcdefghij\xFFklmnopqrstuvwxyz");
+
+    run(L, "ascii", "CPU 12.5%  MEM 2048/8192 MB  LOAD 0.42 0.37 0.31  "
+                    "uptime 12 days, 04:17", iters);
+    run(L, "cjk", "你好世界中文支持给你一张过去的窗口你好世界", iters);
+    run(L, "mixed", "Window 中文1 - 状态 OK / Window 世界3 - 状态 FAIL", iters);
+
+    lua_close(L);
+    return 0;
+}
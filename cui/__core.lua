@@ -137,18 +137,81 @@ local class_metas = {
 
 unpack = table.unpack
 
+--[[ method resolution ]----------------------------------------------------
+a class table is an empty proxy. the members defined in the class are kept
+in its defs table, and lookups, from the class or its instances, hit a flat
+table with the members of the class and of all its parents, in resolution
+order (the class first, then each parent in order, with its own parents).
+the flat table is built on the first lookup and built again, for the class
+and the classes derived from it, after any member of the class changes
+--------------------------------------------------------------------------]]
+local classes = setmetatable({}, { __mode = 'k' })  -- class -> record
+
+-- mark the flat members of a class and of its descendants out of date
+local function class_changed(r)
+    if (r.flat) then
+        r.flat = nil
+        r.cmt.__index = r.resolve
+        r.mt.__index = r.resolve
+        for c in pairs(r.children) do
+            class_changed(classes[c])
+        end
+    end
+end
+
+-- build the flat members of a class
+local function class_flatten(r)
+    local flat = {}
+    for k, v in pairs(r.defs) do
+        flat[k] = v
+    end
+    for i = 1, r.parents.n do
+        local p = classes[r.parents[i]]
+        for k, v in pairs(p.flat or class_flatten(p)) do
+            if (flat[k] == nil) then
+                flat[k] = v
+            end
+        end
+    end
+    r.flat = flat
+    r.cmt.__index = flat
+    r.mt.__index = flat
+    return flat
+end
+
 function class(name, ...)
-  local arg = table.pack(...)
+    local arg = table.pack(...)
     local __parent  = arg
-    local members = {
+    local members = {}
+    local defs = {
         __parent    = __parent,
         __name      = name,
     }
     local mt = {
         __metatable = members,
-        __index     = members
     }
 
+    -- class record: the members table itself stays empty, so that every
+    -- change to it goes through __newindex
+    local r = { defs = defs, mt = mt, parents = __parent, children = {} }
+    r.resolve = function(_, key)
+        return (r.flat or class_flatten(r))[key]
+    end
+    r.cmt = {
+        __index = r.resolve,
+        __newindex = function(_, key, value)
+            defs[key] = value
+            class_changed(r)
+        end,
+        __metatable = arg.n == 1 and __parent[1] or __parent,
+    }
+    mt.__index = r.resolve
+    classes[members] = r
+    for i = 1, arg.n do
+        classes[__parent[i]].children[members] = true
+    end
+    setmetatable(members, r.cmt)
+
     -- function used to create a new instance of the function
     local init = false
     members.new = function(self, ...)
@@ -179,7 +242,10 @@ function class(name, ...)
                 if (b) then return b end
             end
         end
-        return inh(members)
+        -- the parents never change, so the answer is kept
+        local p = inh(members)
+        if (p) then rawset(t, name, p) end
+        return p
     end
 
     members.super = __parent[1]
@@ -187,15 +253,12 @@ function class(name, ...)
     local imt = { __metatable = inherit, __index = inherit }
     setmetatable(members.inherited, imt)
 
-    -- set metatable
     if (arg.n == 1) then
         -- default constructor - pass the parameters to the parent constructor
         local p = __parent[1]
         members[name] = function(self, ...)
             p[p.__name](self, unpack(arg))
         end
-        -- only one parent class
-        setmetatable(members, {__metatable = p, __index = p})
     elseif (arg.n > 1) then
         -- default constructor - pass the parameters to the parent constructors
         members[name] = function(self, ...)
@@ -204,20 +267,6 @@ function class(name, ...)
                 p[p.__name](self, unpack(arg))
             end
         end
-        -- several parent classes
-        setmetatable(members, {
-            __index = function(_, key)
-                -- slow. need to go through all parents manualy
-                for i = 1, arg.n do
-                    local parentmethod = __parent[i][key]
-                    if parentmethod then
-                        return parentmethod
-                    end
-                end
-            end,
-
-            __metatable = __parent
-        })
     end
 
     return members
@@ -331,16 +380,21 @@ Members:
 Methods:
     trect:assign(x1, y1, x2, y2)
     trect:assign(rect)
-    trect:size()    -- return tpoint
+    trect:size([into])  -- return tpoint
     trect:clone()   -- return trect
     trect:move(deltax, deltay)
     trect:grow(deltax, deltay)
-    trect:intersect(rect)
-    trect:union(rect)
+    trect:intersect(rect [, into])
+    trect:union(rect [, into])
     trect:equal(rect)
     trect:contains(point)
     trect:empty()
     trect:nempty()
+
+    assign copies into the points the rect already has, and the methods
+    taking an optional 'into' store their result there and return it,
+    leaving self untouched, so that code run on every frame can keep its
+    geometry in a few objects instead of building new ones
 --------------------------------------------------------------------------]]
 local trect = class('trect')
 
@@ -349,18 +403,31 @@ function trect:trect(x1, y1, x2, y2)
 end
 
 function trect:assign(x1, y1, x2, y2)
-    if (not y1) then
-        self.s = x1.s:clone()
-        self.e = x1.e:clone()
+    local s, e = self.s, self.e
+    if (not s) then
+        if (not y1) then
+            self.s = x1.s:clone()
+            self.e = x1.e:clone()
+        else
+            self.s = tpoint:new(x1, y1)
+            self.e = tpoint:new(x2, y2)
+        end
+    elseif (not y1) then
+        s:assign(x1.s)
+        e:assign(x1.e)
     else
-        self.s = tpoint:new(x1, y1)
-        self.e = tpoint:new(x2, y2)
+        s:assign(x1, y1)
+        e:assign(x2, y2)
     end
     return self
 end
 
-function trect:size()
-    return self.e:clone():sub(self.s)
+function trect:size(into)
+    local s, e = self.s, self.e
+    if (into) then
+        return into:assign(e.x - s.x, e.y - s.y)
+    end
+    return tpoint:new(e.x - s.x, e.y - s.y)
 end
 
 function trect:clone()
@@ -379,24 +446,20 @@ function trect:grow(deltax, deltay)
     return self
 end
 
-function trect:intersect(r)
+function trect:intersect(r, into)
     local s, e = self.s, self.e
+    into = into or self
 
-    s.x = max(s.x, r.s.x)
-    s.y = max(s.y, r.s.y)
-    e.x = min(e.x, r.e.x)
-    e.y = min(e.y, r.e.y)
-    return self
+    return into:assign(max(s.x, r.s.x), max(s.y, r.s.y),
+                       min(e.x, r.e.x), min(e.y, r.e.y))
 end
 
-function trect:union(r)
+function trect:union(r, into)
     local s, e = self.s, self.e
+    into = into or self
 
-    s.x = min(s.x, r.s.x)
-    s.y = min(s.y, r.s.y)
-    e.x = max(e.x, r.e.x)
-    e.y = max(e.y, r.e.y)
-    return self
+    return into:assign(min(s.x, r.s.x), min(s.y, r.s.y),
+                       max(e.x, r.e.x), max(e.y, r.e.y))
 end
 
 function trect:equal(r)
@@ -451,17 +514,16 @@ local _cui                      -- private variable to access cui members
 local cui_app                   -- application object
 local main_window               -- main curses window
 local screen_lock = 0           -- screen lock/update counter
-local colors = {}               -- color pair list
 local cursor_visibility         -- cursor state
 local cursor = tpoint:new(0,0)  -- cursor position in screen
-local event_queue = {}          -- event queue
+local event_queue = curses.new_queue() -- event queue
+-- time limit in ms within which Esc-key sequences are detected as
+-- Alt-letter sequences. useful when we can't generate Alt-letter
+-- sequences directly
+local esc_delay = 100
 
 -- defined later
 local make_color
-local get_key
-local esc_delay
-local init_keymap
-local key_map
 
 --[[ Basic Event class ]----------------------------------------------------
 Members:
@@ -482,10 +544,26 @@ function tevent:tevent(type, command, extra)
     self.extra = extra
 end
 
+--[[ dispatch counters ]----------------------------------------------------
+events dispatched from the top (main loop and message), handler calls made
+by groups for them, and subscriber lists built (see tgroup:handle_event)
+--------------------------------------------------------------------------]]
+local dispatch = { events = 0, calls = 0, builds = 0 }
+
+-- events, calls, builds = dispatch_stats([reset])
+local function dispatch_stats(reset)
+    local events, calls, builds = dispatch.events, dispatch.calls, dispatch.builds
+    if (reset) then
+        dispatch.events, dispatch.calls, dispatch.builds = 0, 0, 0
+    end
+    return events, calls, builds
+end
+
 -- send a message to a window
 local function message(receiver, type, command, extra)
     if (receiver and receiver.inherited.tview) then
         local event = tevent:new(type, command, extra)
+        dispatch.events = dispatch.events + 1
         receiver:handle_event(event)
         return event.extra
     end
@@ -561,6 +639,10 @@ enum(tevent, {
     'be_max' })
 --  known keyboard events (ev_keyboard)
 enum(tevent, { 'ke_max' })
+-- event queue priorities (tprogram:put_event, tprogram:post)
+tevent.pr_urgent = 0
+tevent.pr_normal = 1
+tevent.pr_deferred = 2
 
 --[[ Base window object ]---------------------------------------------------
 tview private members:
@@ -570,6 +652,10 @@ tview private members:
     tview._cursor       -- tpoint
     tview._window       -- curses window
     tview._full_redraw  -- [used internaly for drawing operations]
+    tview._zindex       -- position in the parent _zorder list
+    tview._line         -- chstr returned by line_buffer
+    tview._options      -- values behind options
+    tview._event        -- values behind event
     tview._next
     tview._previous
 
@@ -608,13 +694,13 @@ tview methods:
     tview:tview(bounds)
     tview:close()
     tview:set_bounds(bounds)
-    tview:bounds()          -- return _bounds:clone()
-    tview:size_limits()     -- return tpoint, tpoint
-    tview:calc_bounds(delta)    -- return trect
+    tview:bounds([into])    -- return _bounds:clone(), or a copy in into
+    tview:size_limits()     -- return tpoint, tpoint (read only)
+    tview:calc_bounds(delta [, into])   -- return trect
     tview:change_bounds(bounds)
     tview:handle_event(event)
     tview:get_event(event)
-    tview:put_event(event)
+    tview:put_event(event, priority)
     tview:is_valid(data)
     tview:end_modal(data)
     tview:window()
@@ -624,7 +710,7 @@ tview methods:
     tview:lock()
     tview:unlock()
     tview:goto(x, y)
-    tview:cursor()  -- return tpoint
+    tview:cursor([into])    -- return tpoint
     tview:reset_cursor()
     tview:show(visible)
     tview:set_state(state_name, enable)
@@ -637,6 +723,8 @@ tgroup: tview
 tgroup private members:
     tgroup._current
     tgroup._first
+    tgroup._zorder      -- visible sub windows, as passed to window:compose
+    tgroup._subscribers -- children interested in each event type, per phase
 
 tgroup members:
     tgroup.scroll   -- tpoint
@@ -671,6 +759,21 @@ tgroup public methods:
 local tview = class('tview')
 local tgroup = class('tgroup', tview)
 
+-- a table whose changes drop the subscriber lists of the view's parent.
+-- the values are kept in store
+local function watched(view, store)
+    return setmetatable({}, {
+        __index = store,
+        __newindex = function(t, k, v)
+            if (store[k] ~= v) then
+                store[k] = v
+                local g = view.parent
+                if (g) then g._subscribers = nil end
+            end
+        end
+    })
+end
+
 -- constructor
 local _tag_num = 0
 function tview:tview(bounds)
@@ -694,7 +797,8 @@ function tview:tview(bounds)
     self.grow.hiy               = false     --
 
     -- options
-    self.options = {}
+    self._options = {}
+    self.options = watched(self, self._options)
     self.options.selectable     = false     -- true if window can be selected
     self.options.top_select     = false     -- if true, selecting window will bring it to front
     self.options.pre_event      = false     -- receive event before focused window
@@ -704,7 +808,8 @@ function tview:tview(bounds)
     self.options.validate       = false     -- validate
 
     -- event mask - wich commands to process
-    self.event = {}
+    self._event = {}
+    self.event = watched(self, self._event)
 
     -- cursor coords
     self._cursor = tpoint:new(0, 0)
@@ -779,6 +884,20 @@ function tgroup:foreach(f)
     end
 end
 
+-- call a method of every visible child window, like foreach but without
+-- building a closure on each call
+local function foreach_visible(group, method, ...)
+    local first = group._first
+    local w = first
+    while (w) do
+        local next = w._next
+        if (w.state.visible) then
+            w[method](w, ...)
+        end
+        w = next ~= first and next or nil
+    end
+end
+
 
 --[ bounds ]----------------------------------------------------------------
 
@@ -787,27 +906,45 @@ function tview:set_bounds(bounds)
     --assert(bounds.s.x >= 0 and bounds.s.y >= 0)
     --assert(bounds.e.x > bounds.s.x and bounds.e.y > bounds.s.y)
 
+    -- copied into the rect and point the view already has
+    if (self._bounds) then
+        self._bounds:assign(bounds)
+    else
+        self._bounds = bounds:clone()
+    end
+    local s = bounds:size(self.size)
+    self.size = s
+    local lines, cols = s.y > 0 and s.y or 1, s.x > 0 and s.x or 1
     if (self._window) then
-        self._window:close()
+        -- keep the pad, it is only reallocated when it grows past capacity
+        self._window:resize_keep(lines, cols)
+        self._window:erase()
+    else
+        self._window = _cui.new_pad(lines, cols)
+        self._window:leaveok(true)
     end
-    self._bounds = bounds:clone()
-    self.size = bounds:size()
-    local s = self.size
-    self._window = _cui.new_pad(s.y > 0 and s.y or 1, s.x > 0 and s.x or 1)
-    self._window:leaveok(true)
     self._full_redraw = true
+    if (self.parent) then
+        self.parent._zorder = nil
+    end
 end
 
-function tview:bounds()
+function tview:bounds(into)
+    if (into) then
+        return into:assign(self._bounds)
+    end
     return self._bounds:clone()
 end
 
+local min_size_limit = tpoint:new(1, 1)
+local max_size_limit = tpoint:new(1000, 1000)
+
 function tview:size_limits()
-    return tpoint:new(1, 1), tpoint:new(1000, 1000)
+    return min_size_limit, max_size_limit
 end
 
-function tview:calc_bounds(delta)
-    local bounds = self:bounds()
+function tview:calc_bounds(delta, into)
+    local bounds = self:bounds(into)
     local g = self.grow
 
     if (self.grow.lox) then bounds.s.x = bounds.s.x + delta.x end
@@ -829,22 +966,32 @@ function tview:change_bounds(bounds)
 end
 
 function tgroup:change_bounds(bounds)
-    local size = bounds:size()
+    -- the group keeps its own delta and child bounds, the children consume
+    -- them before any of their sub windows reuse theirs
+    local delta = self._delta or tpoint:new(0, 0)
+    local child = self._child_bounds or trect:new(0, 0, 0, 0)
+    self._delta, self._child_bounds = delta, child
+
+    local size = bounds:size(delta)
     -- verify size limits
     local minl, maxl = self:size_limits()
     if (minl.x > size.x or minl.y > size.y or maxl.x < size.x or maxl.y < size.y) then
         return
     end
     --
-    local delta = size:sub(self.size)
+    delta:sub(self.size)
     self:set_bounds(bounds)
     if (delta.x == 0 and delta.y == 0) then
         self:refresh()
     else
         self:lock()
-        self:foreach(function(w)
-            w:change_bounds(w:calc_bounds(delta))
-        end)
+        local first = self._first
+        local w = first
+        while (w) do
+            local next = w._next
+            w:change_bounds(w:calc_bounds(delta, child))
+            w = next ~= first and next or nil
+        end
         self:unlock()
     end
 end
@@ -886,7 +1033,10 @@ local function remove_view(g, w)
 
     w._next = nil
     w._previous = nil
+    w._zindex = nil
     w.parent = nil
+    g._zorder = nil
+    g._subscribers = nil
 end
 
 local function insert_view(g, w, next)
@@ -911,6 +1061,8 @@ local function insert_view(g, w, next)
         next._previous = w
     end
     w.parent = g
+    g._zorder = nil
+    g._subscribers = nil
 end
 
 function tgroup:insert_before(window, next)
@@ -922,14 +1074,14 @@ function tgroup:insert_before(window, next)
 
     -- center if options are set
     local bounds = window._bounds
-    local org = bounds.s:clone()
+    local x, y = bounds.s.x, bounds.s.y
     if (window.options.centerx) then
-        org.x = math.floor((self.size.x - window.size.x) / 2)
+        x = math.floor((self.size.x - window.size.x) / 2)
     end
     if (window.options.centery) then
-        org.y = math.floor((self.size.y - window.size.y) / 2)
+        y = math.floor((self.size.y - window.size.y) / 2)
     end
-    bounds:move(org:sub(bounds.s))
+    bounds:move(x - bounds.s.x, y - bounds.s.y)
 
     insert_view(self, window, next)
 
@@ -968,50 +1120,91 @@ function tview:get_event()
     return self.parent:get_event()
 end
 
-function tview:put_event(event)
-    return self.parent:put_event(event)
+function tview:put_event(event, priority)
+    return self.parent:put_event(event, priority)
 end
 
-local function do_handle_event(group, event, phase)
-    if (not group or not group._first) then return end
+--[[ event subscribers ]----------------------------------------------------
+a group keeps, per event type, the children that take the event before the
+focused view (pre_event), after it (post_event), and, for broadcast and idle
+events, all that take it. a list is built the first time it is needed and
+dropped when a child is inserted or removed, or changes its options or
+event mask
+--------------------------------------------------------------------------]]
+local no_subscribers = { n = 0 }
+
+local function subscribers(group, phase, type)
+    if (type == nil) then return no_subscribers end
+    local cache = group._subscribers
+    if (not cache) then
+        cache = { [-1] = {}, [0] = {}, [1] = {} }
+        group._subscribers = cache
+    end
 
-    if (phase < 0) then
-        event.pre_event = true
+    local list = cache[phase][type]
+    if (not list) then
+        local n = 0
+        list = {}
         group:foreach(function(w)
-            if (w.options.pre_event and w.event[event.type]) then
-                w:handle_event(event)
+            if (w.event[type] and (phase == 0 or
+                (phase < 0 and w.options.pre_event) or
+                (phase > 0 and w.options.post_event))) then
+                n = n + 1
+                list[n] = w
             end
         end)
-        event.pre_event = nil
-    elseif (phase == 0) then
-        if (event.type ~= tevent.ev_broadcast and event.type ~= tevent.ev_idle) then
-            local current = group._current
-            if (current and current.event[event.type]) then
-                current:handle_event(event)
-            end
-        else
-            group:foreach(function(w)
-                if (w.event[event.type]) then
-                    w:handle_event(event)
-                end
-            end)
+        list.n = n
+        cache[phase][type] = list
+        dispatch.builds = dispatch.builds + 1
+    end
+    return list
+end
+
+local function notify(group, list, event)
+    for i = 1, list.n do
+        local w = list[i]
+        -- a handler may consume the event (type set to nil), or remove a
+        -- view or change its mask on the way
+        local type = event.type
+        if (type == nil) then return end
+        if (w.parent == group and w.event[type]) then
+            dispatch.calls = dispatch.calls + 1
+            w:handle_event(event)
         end
-    elseif (phase > 0) then
-        event.post_event = true
-        group:foreach(function(w)
-            if (w.options.post_event and w.event[event.type]) then
-                w:handle_event(event)
-            end
-        end)
-        event.post_event = nil
     end
 end
 
-
+-- each phase picks its list from the type the event has by then, and
+-- an event consumed by an earlier phase goes no further
 function tgroup:handle_event(event)
-    do_handle_event(self, event, -1)
-    do_handle_event(self, event, 0)
-    do_handle_event(self, event, 1)
+    if (not self._first) then return end
+
+    local pre = subscribers(self, -1, event.type)
+    if (pre.n > 0) then
+        event.pre_event = true
+        notify(self, pre, event)
+        event.pre_event = nil
+    end
+
+    local type = event.type
+    if (type == nil) then
+        return
+    elseif (type ~= tevent.ev_broadcast and type ~= tevent.ev_idle) then
+        local current = self._current
+        if (current and current.event[type]) then
+            dispatch.calls = dispatch.calls + 1
+            current:handle_event(event)
+        end
+    else
+        notify(self, subscribers(self, 0, type), event)
+    end
+
+    local post = subscribers(self, 1, event.type)
+    if (post.n > 0) then
+        event.post_event = true
+        notify(self, post, event)
+        event.post_event = nil
+    end
 end
 
 function tview:is_valid(data)
@@ -1055,21 +1248,28 @@ local function exec_view(window, parent, modal)
     end
     --
     local event
-    local will_sleep
+    local idle = false
     window.modal_state = nil
     repeat
         event = window:get_event()
         if (event) then
+            dispatch.events = dispatch.events + 1
             window:handle_event(event)
-            will_sleep = false
+            idle = false
         else
-            -- idle action
-            will_sleep = not message(cui_app, tevent.ev_idle)
+            -- run due timers
+            _cui.timer_run()
+            -- idle action, once each time the queue runs dry unless a
+            -- view asks for more
+            if (not idle) then
+                idle = not message(cui_app, tevent.ev_idle)
+            end
         end
 
         --
-        if (will_sleep and not window.modal_state) then
-            _cui.napms(50)
+        if (idle and not window.modal_state) then
+            -- block until a key, a signal (resize) or the next timer
+            _cui.wait_input(_cui.timer_next() or -1)
         end
     until window.modal_state
     --
@@ -1116,8 +1316,8 @@ local function update_screen()
     if (cui_app and cui_app.state.visible) then
         --io.stderr:write(_TRACEBACK('update screen'), '\n')
 
-        -- update screen
-        cui_app._window:copy(main_window, 0, 0, 0, 0, cui_app.size.y-1, cui_app.size.x-1)
+        -- update screen, copying only the rows drawn since the last update
+        cui_app._window:copy_damaged(main_window, 0, 0, 0, 0, cui_app.size.y-1, cui_app.size.x-1)
 
         local topw = top_window()
         local cvis
@@ -1130,8 +1330,7 @@ local function update_screen()
             cvis = 1
         end
 
-        local cursor = topw:cursor()
-        local tcursor
+        topw:cursor(cursor)
         if (cvis ~= 0) then
             local w = topw
             while (w.parent) do
@@ -1169,6 +1368,19 @@ function tview:draw_window()
     self:window():clear()
 end
 
+-- a cleared chstr of len cells, kept by the view between redraws
+function tview:line_buffer(len)
+    local line = self._line
+    if (line) then
+        line:resize(len)
+        line:clear()
+    else
+        line = _cui.new_chstr(len)
+        self._line = line
+    end
+    return line
+end
+
 -- print self in parent window
 function tview:refresh()
     self:draw_window()
@@ -1190,41 +1402,44 @@ end
 -- drawing interface
 function tgroup:draw_window()
     -- draw sub windows
-    self:foreach(function(w)
-        if (w.state.visible) then
-            w:draw_window()
-        end
-    end)
+    foreach_visible(self, 'draw_window')
 end
 
-local function draw_child(group, window)
-    -- bounds check, etc etc, draw child in pad
-    local gw = group.size.x
-    local gh = group.size.y
-    local scroll = group.scroll
-    local r = window:bounds()
-    local sx = r.s.x - scroll.x sx = sx > 0 and 0 or -sx
-    local sy = r.s.y - scroll.y sy = sy > 0 and 0 or -sy
-
-    r:move(-scroll.x, -scroll.y):intersect(trect:new(0, 0, gw, gh))
-
-    if (r.e.x > r.s.x and r.e.y - r.s.y) then
-        window._window:copy(group._window, sy, sx, r.s.y, r.s.x, r.e.y-1, r.e.x-1)
+-- visible sub windows, bottom to top, as the flat list used by
+-- window:compose. rebuilt after the order, bounds or visibility of a
+-- sub window change
+local function zorder(group)
+    local list = group._zorder
+    if (not list) then
+        list = {}
+        local n = 0
+        group:foreach(function(w)
+            w._zindex = nil
+            if (w.state.visible) then
+                local b = w._bounds
+                n = n + 1
+                w._zindex = n
+                list[5*n-4] = w._window
+                list[5*n-3] = b.s.y
+                list[5*n-2] = b.s.x
+                list[5*n-1] = b.e.y - b.s.y
+                list[5*n]   = b.e.x - b.s.x
+            end
+        end)
+        list.n = n
+        group._zorder = list
     end
+    return list
 end
 
 function tgroup:redraw(onparent)
     self:lock()
 
-    -- redraw sub windows
-    self:foreach(function(w)
-        if (w.state.visible) then
-            -- cause groups to repaint
-            w:redraw(false)
-            -- draw sub window on personal window
-            draw_child(self, w)
-        end
-    end)
+    -- cause sub groups to repaint
+    foreach_visible(self, 'redraw', false)
+    -- draw sub windows on personal window
+    local list = zorder(self)
+    self._window:compose(list, list.n, self.scroll.y, self.scroll.x)
     self.inherited.tview.redraw(self, onparent)
 
     self:unlock()
@@ -1244,24 +1459,18 @@ end
 -- private
 function tgroup:draw_child(window)
     self:lock()
-    local first = self._first
-    local bounds = window:bounds()
-    local w = window
-    if (w._full_redraw) then
-        w._full_redraw = nil
-        w = self._first
+    local list = zorder(self)
+    local scroll = self.scroll
+    if (window._full_redraw or not window._zindex) then
+        -- moved, shown or hidden: repaint its area from every sub window
+        local b = window._bounds
+        window._full_redraw = nil
+        self._window:compose_rect(list, list.n, scroll.y, scroll.x,
+            b.s.y, b.s.x, b.e.y - b.s.y, b.e.x - b.s.x)
+    else
+        -- repaint the rows it touched and whatever covers them
+        self._window:compose(list, list.n, scroll.y, scroll.x, window._zindex)
     end
-    repeat
-        -- check for overlapping areas
-        if (w.state.visible and w:bounds():intersect(bounds):nempty()) then
-            draw_child(self, w)
-            -- if they overlap, join them. use the resulting rectangle
-            -- to check for overlapping areas on the following windows
-            bounds:union(w._bounds)
-        end
-
-        w = w._next
-    until w == first
     self:unlock()
 end
 
@@ -1286,7 +1495,10 @@ end
 
 tview.jump = tview.goto_
 
-function tview:cursor()
+function tview:cursor(into)
+    if (into) then
+        return into:assign(self._cursor)
+    end
     return self._cursor:clone()
 end
 
@@ -1308,6 +1520,9 @@ function tview:set_state(state, enable)
     self.state[state] = enable
     if (state == 'visible') then
         self._full_redraw = true
+        if (self.parent) then
+            self.parent._zorder = nil
+        end
         self:redraw(true)
     elseif (state == 'selected') then
         message(self.parent, tevent.ev_broadcast, tevent.be_selected, { window = self, enable = enable })
@@ -1436,7 +1651,13 @@ Methods:
     tprogram:set_bounds(bounds)
     tprogram:run()
     tprogram:get_event()
-    tprogram:put_event()
+    tprogram:put_event(event, priority)
+    tprogram:post(type, command, extra, priority)
+
+Events are queued by priority (tevent.pr_urgent, pr_normal or pr_deferred,
+pr_normal by default) and in order within one priority. Pending keys are
+read into the queue at pr_normal whenever nothing more urgent is waiting,
+so keyboard input goes ahead of deferred events.
 --------------------------------------------------------------------------]]
 local tprogram = class('tprogram', tgroup)
 
@@ -1449,7 +1670,6 @@ function tprogram:tprogram()
     _cui.nl(false)
     _cui.map_keyboard(true)
     if (_cui.has_colors()) then _cui.start_color() end
-    init_keymap()
 
     -- main window will be used to set the screen cursor and to handle
     -- keyboard events
@@ -1500,160 +1720,44 @@ function tprogram:run()
 end
 
 function tprogram:get_event()
-    -- check event queue
-    local event = event_queue[1]
-    if (event) then
-        table.remove(event_queue, 1)
-        return event
+    -- check keyboard, queueing every pending key at once (paste bursts)
+    if (event_queue:len(tevent.pr_normal) == 0) then
+        event_queue:read_keys(main_window, tevent.ev_keyboard,
+            tevent.pr_normal, esc_delay)
     end
 
-    -- check keyboard
-    local key_code, key_name, key_meta = get_key()
-    if (key_code) then
-        if (key_name == "Resize" or key_name == "CtrlL") then
+    -- check event queue; records are (event) from put_event,
+    -- (type, command, extra) from post or (type, code, name, meta) for keys
+    local etype, command, extra, meta = event_queue:take()
+    if (etype == tevent.ev_keyboard) then
+        if (extra == "Resize" or extra == "CtrlL") then
             self:change_bounds(trect:new(0,0,_cui.columns(),_cui.lines()))
             self:refresh()
         else
-            return tkeyboard_event:new(tevent.ev_keyboard, key_code, key_name, key_meta)
+            return tkeyboard_event:new(etype, command, extra, meta)
         end
+    elseif (type(etype) == 'table') then
+        return etype
+    elseif (etype) then
+        return tevent:new(etype, command, extra)
     end
 
     -- nothing to return...
     -- return
 end
 
-function tprogram:put_event(event)
-    table.insert(event_queue, event)
-end
-
---[[ lookup table to translate keys to string names ]---------------------]]
--- this is the time limit in ms within Esc-key sequences are detected as
--- Alt-letter sequences. useful when we can't generate Alt-letter sequences
--- directly. sometimes this pause may be longer than expected since the
--- curses driver may also pause waiting for another key (ncurses-5.3)
-local esc_delay = 400
-
-function init_keymap()
-    local _cui = _cui
-    key_map =
-    {
-        -- ctrl-letter codes
-        [ 1] = "CtrlA", [ 2] = "CtrlB", [ 3] = "CtrlC",
-        [ 4] = "CtrlD", [ 5] = "CtrlE", [ 6] = "CtrlF",
-        [ 7] = "CtrlG", [ 8] = "CtrlH", [ 9] = "CtrlI",
-        [10] = "CtrlJ", [11] = "CtrlK", [12] = "CtrlL",
-        [13] = "CtrlM", [14] = "CtrlN", [15] = "CtrlO",
-        [16] = "CtrlP", [17] = "CtrlQ", [18] = "CtrlR",
-        [19] = "CtrlS", [20] = "CtrlT", [21] = "CtrlU",
-        [22] = "CtrlV", [23] = "CtrlW", [24] = "CtrlX",
-        [25] = "CtrlY", [26] = "CtrlZ",
-
-        [  8] = "Backspace",
-        [  9] = "Tab",
-        [ 10] = "Enter",
-        [ 13] = "Enter",
-        [ 27] = "Escape",
-        [ 31] = "CtrlBackspace",
-        [127] = "Backspace",
-
-        [_cui.KEY_DOWN      ] = "Down",
-        [_cui.KEY_UP        ] = "Up",
-        [_cui.KEY_LEFT      ] = "Left",
-        [_cui.KEY_RIGHT     ] = "Right",
-        [_cui.KEY_HOME      ] = "Home",
-        [_cui.KEY_END       ] = "End",
-        [_cui.KEY_NPAGE     ] = "PageDown",
-        [_cui.KEY_PPAGE     ] = "PageUp",
-        [_cui.KEY_IC        ] = "Insert",
-        [_cui.KEY_DC        ] = "Delete",
-        [_cui.KEY_BACKSPACE ] = "Backspace",
-        [_cui.KEY_F1        ] = "F1",
-        [_cui.KEY_F2        ] = "F2",
-        [_cui.KEY_F3        ] = "F3",
-        [_cui.KEY_F4        ] = "F4",
-        [_cui.KEY_F5        ] = "F5",
-        [_cui.KEY_F6        ] = "F6",
-        [_cui.KEY_F7        ] = "F7",
-        [_cui.KEY_F8        ] = "F8",
-        [_cui.KEY_F9        ] = "F9",
-        [_cui.KEY_F10       ] = "F10",
-        [_cui.KEY_F11       ] = "F11",
-        [_cui.KEY_F12       ] = "F12",
-
-        [_cui.KEY_RESIZE    ] = "Resize",
-
-        [_cui.KEY_BTAB      ] = "ShiftTab",
-        [_cui.KEY_SDC       ] = "ShiftDelete",
-        [_cui.KEY_SIC       ] = "ShiftInsert",
-        [_cui.KEY_SEND      ] = "ShiftEnd",
-        [_cui.KEY_SHOME     ] = "ShiftHome",
-        [_cui.KEY_SLEFT     ] = "ShiftLeft",
-        [_cui.KEY_SRIGHT    ] = "ShiftRight",
-    }
+function tprogram:put_event(event, priority)
+    event_queue:post(priority or tevent.pr_normal, event)
 end
 
-function get_key()
-    local ch = main_window:getch()
-    if (not ch) then return end
-
-    local alt = ch == 27
-
-    if (alt) then
-        ch = main_window:getch()
-        if (not ch) then
-            -- since there is no way to know the time with millisecond precision
-            -- we pause the the program until we get a key or the time limit
-            -- is reached
-            local t = 0
-            repeat
-                _cui.napms(10) t = t + 10
-                ch = main_window:getch()
-            until ch or t >= esc_delay
-            -- nothing was typed... return Esc
-            if (not ch) then return "Esc" end
-        end
-        if (ch > 96 and ch < 123) then ch = ch - 32 end
-    end
-
-    local k = key_map[ch]
-    local key_name
-    if (k) then
-        key_name = alt and "Alt"..k or k
-    elseif (ch < 256) then
-        key_name = alt and "Alt"..string.char(ch) or string.char(ch)
-    else
-        return nil
-    end
-    return ch, key_name, alt
+-- queue an event without building the event object until it is delivered
+function tprogram:post(type, command, extra, priority)
+    event_queue:post(priority or tevent.pr_normal, type, command, extra)
 end
 
 --[[ color assignment ]---------------------------------------------------]]
-function make_color(fg, bg)
-    if (not _cui.has_colors()) then return 0 end
-    local n = #(colors)
-    local c
-
-    -- see if we have an existing color in list
-    for _, c in ipairs(colors) do
-        if (c.fg == fg and c.bg == bg) then
-            return c.attr
-        end
-    end
-
-    n = n + 1
-    if (not _cui.init_pair(n, fg, bg)) then
-        error('failed to initialize color pair ('..n..','..fg..','..bg..')')
-    end
-
-    -- add new color
-    c = {
-        fg = fg,
-        bg = bg,
-        attr = _cui.color_pair(n)
-    }
-    table.insert(colors, c)
-    return c.attr
-end
+-- color pairs are allocated, cached and reused by the curses module
+make_color = curses.make_color
 
 --[[ exported interface ]-------------------------------------------------]]
 _cui = {
@@ -1672,6 +1776,7 @@ _cui = {
     -- functions
     clog = clog,
     message = message,
+    dispatch_stats = dispatch_stats,
     make_color = make_color,
 }
 
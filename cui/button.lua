@@ -49,8 +49,10 @@ end
 function tbutton:draw_window()
     local w = self:window()
     local attr = self.state.focused and self.fcolor or self.ncolor
-    local str = _cui.new_chstr(self.size.x)
-    str:set_str(0, '['..string.rep(' ', self.size.x - 2)..']', attr)
+    local str = self:line_buffer(self.size.x)
+    str:set_ch(0, ' ', attr, self.size.x)
+    str:set_str(0, '[', attr)
+    str:set_str(self.size.x - 1, ']', attr)
     str:set_str(math.floor((self.size.x - string.len(self.label)) / 2), self.label, attr)
     w:mvaddchstr(0, 0, str)
 end
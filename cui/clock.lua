@@ -9,7 +9,6 @@ require 'cui'
 -- locals
 local _cui, cui = cui, nil  -- make sure we don't use 'cui' directly
 local class = _cui.class
-local tevent = _cui.tevent
 local tview = _cui.tview
 
 --[[ tclock ]---------------------------------------------------------------
@@ -18,9 +17,10 @@ tclock:tview
 Members:
     tclock.last_time
     tclock.color
+    tclock.timer
 Methods:
     tclock:tclock(bounds)
-    tclock:handle_event(event)
+    tclock:close()
     tclock:draw_window()
     tclock:update()
 --]]------------------------------------------------------------------------
@@ -33,25 +33,24 @@ function tclock:tclock(bounds)
     self.grow.lox = true
     self.grow.hix = true
 
-    -- event mask
-    self.event[tevent.ev_idle] = true
-
     -- members
     self.last_time = 0
     self.color = _cui.make_color(_cui.COLOR_BLUE, _cui.COLOR_WHITE)
 
     self:update()
+
+    -- periodic update
+    self.timer = _cui.timer_add(500, function() self:update() end, true)
 end
 
-function tclock:handle_event(event)
-    if (event.type == tevent.ev_idle) then
-        self:update()
-    end
+function tclock:close()
+    _cui.timer_remove(self.timer)
+    self.inherited.tview.close(self)
 end
 
 function tclock:draw_window()
     local w = self:window()
-    local str = _cui.new_chstr(self.size.x)
+    local str = self:line_buffer(self.size.x)
     str:set_str(0, os.date('%H:%M:%S', self.last_time), self.color)
     self:window():mvaddchstr(0, 0, str)
 end
@@ -42,7 +42,7 @@ function tdesktop:init_background()
     function bg:draw_window()
         local w = self:window()
         local len = self.size.x
-        local str = _cui.new_chstr(len)
+        local str = self:line_buffer(len)
         str:set_ch(0, _cui.ACS_BLOCK, _cui.make_color(_cui.COLOR_BLUE, _cui.COLOR_BLUE) + _cui.A_BOLD, len)
         for y = 0, self.size.y - 1 do
             w:mvaddchstr(y, 0, str)
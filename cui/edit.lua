@@ -74,7 +74,7 @@ function tedit:tedit(bounds, text, maxlen, readonly)
 end
 
 function tedit:draw_window()
-    local line = _cui.new_chstr(self.size.x)
+    local line = self:line_buffer(self.size.x)
     local start = self.start
     local text = self.text
     local len = string.len(text)
@@ -58,7 +58,7 @@ function tframe:draw_window()
     w:border()
     if (self.title) then
         local len = string.len(self.title)
-        local title = _cui.new_chstr(len + 4)
+        local title = self:line_buffer(len + 4)
         title:set_str(1, ' '..self.title..' ', attr)
         if (focused) then
             title:set_ch(0, _cui.ACS_RTEE, attr)
@@ -37,10 +37,10 @@ end
 function tlabel:draw_window()
     local w = self:window()
     local width = self.size.x
-    local str = _cui.new_chstr(width)
-    local len = string.len(self.text)
+    local str = self:line_buffer(width)
 
-    str:set_str(0, string.sub(self.text, 1, width)..string.rep(' ', width-len), self.attr)
+    str:set_ch(0, ' ', self.attr, width)
+    str:set_str(0, self.text, self.attr)
     w:mvaddchstr(0, 0, str)
 end
 
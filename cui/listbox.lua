@@ -28,14 +28,20 @@ methods:
     tlistbox:set_scrollbar(scrollbar)
     tlistbox:set_columns(columns)
     tlistbox:set_position(index)
+    tlistbox:changed([index])               the list (or one item) changed
+    tlistbox:get_strs(first, n, texts, flags)
     tlistbox:get_str(index, width)          returns list[index][1]
     tlistbox:get_selected(index)            returns list[index].selected
     tlistbox:select_item(index, select)     list[index].selected = select
 
 
-list format: { item, item, ..., item }
+list format: { item, item, ..., item [, n = count] }
 item format: { [1] = text, selected = true/false/nil }
 
+Drawing is done by a curses vlist: only the items that enter the view
+are asked for, through get_strs, and only the rows that changed are
+painted. the default get_strs calls get_str and selected for each item.
+
 Keys:
     Up              -- current = current - 1
     Down            -- current = current + 1
@@ -47,13 +53,20 @@ HOWTO:
     * virtual list:
         call listbox:set_list({ n = size })
         override
-            tlistbox:get_str(index)
+            tlistbox:get_strs(first, n, texts, flags)
+                or tlistbox:get_str(index, width)
             tlistbox:select_item(index, selected)
             tlistbox:get_selected(index)
         [ listbox:set_count(count) -> listbox:set_list({n = count}) ]
+        call listbox:changed(index) when the text of an item changes
 --]]------------------------------------------------------------------------
 local tlistbox = class('tlistbox', tview)
 
+-- number of items in a list
+local function count(list)
+    return list.n or #list
+end
+
 function tlistbox:tlistbox(bounds, columns, list, sbar)
     self:tview(bounds)
     -- new options
@@ -76,6 +89,11 @@ function tlistbox:tlistbox(bounds, columns, list, sbar)
     self.nattr = _cui.make_color(_cui.COLOR_BLACK, _cui.COLOR_CYAN)
     self.sattr = _cui.make_color(_cui.COLOR_WHITE, _cui.COLOR_GREEN) + _cui.A_BOLD
 
+    -- text requests of the native list
+    self._fetch = function(first, n, texts, flags)
+        self:get_strs(first, n, texts, flags)
+    end
+
     self:set_columns(columns)
     self:set_list(list)
     self:set_scrollbar(sbar)
@@ -84,7 +102,7 @@ end
 function tlistbox:set_scrollbar(sbar)
     self.scrollbar = sbar
     if (sbar) then
-        sbar:set_limit(table.getn(self.list), self.size.y)
+        sbar:set_limit(count(self.list), self.size.y)
         sbar:set_position(self.position)
     end
 end
@@ -96,16 +114,24 @@ end
 
 function tlistbox:set_list(list)
     self.list = list or {}
+    self:changed()
     self:set_position(1)
 end
 
+-- forget the drawn text of an item, or of all items
+function tlistbox:changed(index)
+    if (self._vlist) then
+        self._vlist:invalidate(index)
+    end
+end
+
 function tlistbox:set_position(index)
     -- range check
     if (index < 1) then
         index = 1
     end
-    if (index > table.getn(self.list)) then
-        index = table.getn(self.list)
+    if (index > count(self.list)) then
+        index = count(self.list)
     end
 
     self.position = index
@@ -136,7 +162,7 @@ function tlistbox:set_position(index)
         local item = index - top
         local colw = self.column_width
         local col = math.floor((item) / self.size.y) + 1
-        self:goto_(col * (colw + 1) - colw, math.mod(item, self.size.y))
+        self:goto_(col * (colw + 1) - colw, item % self.size.y)
     end
 
     -- update scrollbar
@@ -147,74 +173,56 @@ function tlistbox:set_position(index)
     end
 end
 
-function tlistbox:get_str(index, width)
-    local list = self.list
-    if (index > 0 and index <= table.getn(list)) then
-        local str = list[index][1]
-        do return string.sub(str..string.rep(' ', width), 1, width) end
-        if (string.len(str) >= width) then
-            return string.sub(str, 1, width)
+-- text and selection of count items from first, into texts[i] and
+-- flags[i]. the text is cut or padded to the column width when drawn
+function tlistbox:get_strs(first, n, texts, flags)
+    local width = self.column_width - 2
+    local multiple = not self.options.single_selection
+    for i = 1, n do
+        texts[i] = self:get_str(first + i - 1, width)
+        if (multiple) then
+            flags[i] = self:selected(first + i - 1)
         end
-        return str .. string.rep(' ', width - string.len(str))
-    else
-        return string.rep(' ', width)
     end
 end
 
+function tlistbox:get_str(index, width)
+    local item = self.list[index]
+    return item and item[1] or ''
+end
+
 function tlistbox:select_item(index, select)
     if (self.options.single_selection) then return end
 
     local list = self.list
-    if (index > 0 and index <= table.getn(list)) then
+    if (index > 0 and index <= count(list)) then
         list[index].selected = select
+        self:changed(index)
     end
 end
 
 function tlistbox:selected(index)
     local list = self.list
-    if (index > 0 and index <= table.getn(list)) then
+    if (index > 0 and index <= count(list)) then
         return list[index].selected
     end
 end
 
 function tlistbox:draw_window()
-    local w = self:window()
-    local item = self.top_item
-    local index = self.position
-    local cols = self.columns
-    local colw = self.column_width
-    local str = _cui.new_chstr(colw+1)
-    local a_normal = self.nattr
-    local a_select = self.sattr
-    local attr
-    local selected
-
-    str:set_ch(colw, _cui.ACS_VLINE, a_normal)
-    -- columns cicle
-    for col = 1, cols do
-        -- line cicle
-        for line = 1, self.size.y do
-            if (self.options.single_selection) then
-                selected = item == index
-            else
-                selected = self:selected(item)
-            end
-            if (selected) then
-                attr = a_select
-                str:set_str(0, '<', attr)
-                str:set_str(colw - 1, '>', attr)
-            else
-                attr = a_normal
-                str:set_str(0, ' ', attr)
-                str:set_str(colw - 1, ' ', attr)
-            end
-
-            str:set_str(1, self:get_str(item, colw-2), attr)
-            w:mvaddchstr(line-1, col * (colw + 1) - colw - 1, str)
-
-            item = item + 1
-        end
+    local lines, cols, colw = self.size.y, self.columns, self.column_width
+    if (lines < 1) then return end
+    local v = self._vlist
+    -- the native list is made for one geometry
+    if (not v or self._vlist_lines ~= lines or self._vlist_columns ~= cols
+        or self._vlist_width ~= colw) then
+        v = _cui.new_vlist(lines, cols, colw, self.nattr, self.sattr,
+            '<>', _cui.ACS_VLINE)
+        self._vlist = v
+        self._vlist_lines, self._vlist_columns, self._vlist_width = lines, cols, colw
     end
+
+    local mark = self.options.single_selection and self.position or 0
+    v:draw(self:window(), self.top_item, count(self.list), mark, self._fetch)
 end
 
 function tlistbox:handle_event(event)
@@ -241,7 +249,7 @@ function tlistbox:handle_event(event)
         elseif (key == "Home" or key == "h" or key == "H") then
             self:set_position(1)
         elseif (key == "End" or key == "e" or key == "E") then
-            self:set_position(table.getn(self.list))
+            self:set_position(count(self.list))
         else
             return
         end
@@ -9,7 +9,6 @@ require 'cui'
 -- locals
 local _cui, cui = cui, nil  -- make sure we don't use 'cui' directly
 local class = _cui.class
-local tevent = _cui.tevent
 local tview = _cui.tview
 
 --[[ tmemory ]--------------------------------------------------------------
@@ -18,9 +17,10 @@ tmemory:tview
 Members:
     tmemory.last_time
     tmemory.color
+    tmemory.timer
 Methods:
     tmemory:tmemory(bounds)
-    tmemory:handle_event(event)
+    tmemory:close()
     tmemory:draw_window()
     tmemory:update()
 --]]------------------------------------------------------------------------
@@ -35,25 +35,24 @@ function tmemory:tmemory(bounds)
     self.grow.loy = true
     self.grow.hiy = true
 
-    -- event mask
-    self.event[tevent.ev_idle] = true
-
     -- members
     self.last_time = 0
     self.color = _cui.make_color(_cui.COLOR_BLUE, _cui.COLOR_WHITE)
 
     self:update()
+
+    -- periodic update
+    self.timer = _cui.timer_add(1000, function() self:update() end, true)
 end
 
-function tmemory:handle_event(event)
-    if (event.type == tevent.ev_idle) then
-        self:update()
-    end
+function tmemory:close()
+    _cui.timer_remove(self.timer)
+    self.inherited.tview.close(self)
 end
 
 function tmemory:draw_window()
     local w = self:window()
-    local str = _cui.new_chstr(self.size.x)
+    local str = self:line_buffer(self.size.x)
     --local t, l = gcinfo()
     --local info = t..':'..l
     local info = 'gcinfo'
@@ -33,8 +33,13 @@ end
 
 function tmenubar:draw_window()
     local w = self:window()
+    local line = self:line_buffer(self.size.x)
+    line:set_ch(0, ' ', self.color, self.size.x)
+    for y = 0, self.size.y - 1 do
+        w:mvaddchstr(y, 0, line)
+    end
+
     w:attrset(self.color)
-    w:mvaddstr(0, 0, string.rep(' ', self.size.x*self.size.y))
 
     w:mvaddstr(0, 0, 'Menu Bar')
 end
@@ -86,7 +86,8 @@ function tscrollbar:set_position(position)
     if (position == 1) then
         r_position = 1
     else
-        r_position = math.ceil((position * (self.size.y - 2)) / limit)
+        local length = self.vertical and self.size.y or self.size.x
+        r_position = math.ceil((position * (length - 2)) / limit)
     end
 
     self.position = position
@@ -104,29 +105,10 @@ function tscrollbar:set_position(position)
 end
 
 function tscrollbar:draw_window()
-    local w = self:window()
     local attr = _cui.make_color(_cui.COLOR_WHITE, _cui.COLOR_BLUE)
-    local pos = self.r_position
-
-    if (self.vertical) then
-        w:mvaddch(0, 0, _cui.ACS_UARROW + attr)
-        for y = 2, self.size.y - 1 do
-            w:mvaddch(y-1, 0, 32 + attr)
-            if (pos == y - 1 and self.limit > 1) then
-                w:mvaddch(y-1, 0, string.byte('#') + attr)
-            end
-        end
-        w:mvaddch(self.size.y - 1, 0, _cui.ACS_DARROW + attr)
-    else
-        w:mvaddch(0, 0, _cui.ACS_LARROW + attr)
-        for x = 2, self.size.x - 1 do
-            w:mvaddch(0, x-1, 32 + attr)
-            if (pos == x - 1 and self.limit > 1) then
-                w:mvaddch(0, x-1, string.byte('#') + attr)
-            end
-        end
-        w:mvaddch(0, self.size.x - 1, _cui.ACS_RARROW + attr)
-    end
+    local length = self.vertical and self.size.y or self.size.x
+
+    self:window():draw_scrollbar(self.vertical, length, self.position, self.limit, attr)
 end
 
 local tscroll_indicator -- forward declaration
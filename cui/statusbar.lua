@@ -54,8 +54,9 @@ function tstatusbar:draw_window()
     end
 
     if (x < self.size.x) then
-        w:attrset(tattr)
-        w:addstr(string.rep(' ', self.size.x - x))
+        local fill = self:line_buffer(self.size.x - x)
+        fill:set_ch(0, ' ', tattr, self.size.x - x)
+        w:addchstr(fill)
     end
 end
 
@@ -4,9 +4,16 @@
 *                                                                       *
 ************************************************************************/
 
+/* wcwidth */
+#define _XOPEN_SOURCE 700
+
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "lua.h"
 #include "lauxlib.h"
@@ -16,6 +23,8 @@
 #define _XOPEN_SOURCE_EXTENDED
 #include <ncursesw/ncurses.h>
 #include <signal.h>
+#include <poll.h>
+#include <unistd.h>
 
 /*
 ** =======================================================
@@ -33,6 +42,14 @@ static const char *STDSCR_REGISTRY     = "curses:stdscr";
 static const char *WINDOWMETA          = "curses:window";
 static const char *CHSTRMETA           = "curses:chstr";
 static const char *RIPOFF_TABLE        = "curses:ripoffline";
+static const char *SCRATCH_REGISTRY    = "curses:scratch";
+static const char *CHSTRS_REGISTRY     = "curses:chstrs";
+static const char *COLORS_REGISTRY     = "curses:colors";
+static const char *TIMER_REGISTRY      = "curses:timers";
+static const char *TIMER_CALLBACKS     = "curses:timer_callbacks";
+static const char *QUEUEMETA           = "curses:queue";
+static const char *VLISTMETA           = "curses:vlist";
+static const char *CELLSMETA           = "curses:cells";
 
 #define B(v) ((v == ERR) ? 0 : 1)
 
@@ -112,6 +129,84 @@ static const char *RIPOFF_TABLE        = "curses:ripoffline";
         return 1;                           \
     }
 
+/*
+** window methods, one macro per signature. the curses function is
+** called with the window followed by the unpacked arguments
+*/
+
+#define LCW_VOID(n)                         \
+    static int lcw_ ## n(lua_State *L)      \
+    {                                       \
+        WINDOW *w = lcw_check(L, 1);        \
+        n(w);                               \
+        return 0;                           \
+    }
+
+#define LCW_VOID_BOOL(n)                    \
+    static int lcw_ ## n(lua_State *L)      \
+    {                                       \
+        WINDOW *w = lcw_check(L, 1);        \
+        n(w, lua_toboolean(L, 2));          \
+        return 0;                           \
+    }
+
+#define LCW_BOOLOK_BOOL(n)                  \
+    static int lcw_ ## n(lua_State *L)      \
+    {                                       \
+        WINDOW *w = lcw_check(L, 1);        \
+        int bf = lua_toboolean(L, 2);       \
+        lua_pushboolean(L, B(n(w, bf)));    \
+        return 1;                           \
+    }
+
+#define LCW_BOOLOK_INT(n)                   \
+    static int lcw_ ## n(lua_State *L)      \
+    {                                       \
+        WINDOW *w = lcw_check(L, 1);        \
+        int a = luaL_checkinteger(L, 2);    \
+        lua_pushboolean(L, B(n(w, a)));     \
+        return 1;                           \
+    }
+
+#define LCW_BOOLOK_INT2(n)                  \
+    static int lcw_ ## n(lua_State *L)      \
+    {                                       \
+        WINDOW *w = lcw_check(L, 1);        \
+        int a = luaL_checkinteger(L, 2);    \
+        int b = luaL_checkinteger(L, 3);    \
+        lua_pushboolean(L, B(n(w, a, b)));  \
+        return 1;                           \
+    }
+
+#define LCW_BOOLOK_CHTYPE(n)                \
+    static int lcw_ ## n(lua_State *L)      \
+    {                                       \
+        WINDOW *w = lcw_check(L, 1);        \
+        chtype ch = lc_checkchtype(L, 2);   \
+        lua_pushboolean(L, B(n(w, ch)));    \
+        return 1;                           \
+    }
+
+#define LCW_BOOLOK_WIN(n)                   \
+    static int lcw_ ## n(lua_State *L)      \
+    {                                       \
+        WINDOW *w = lcw_check(L, 1);        \
+        WINDOW *d = lcw_check(L, 2);        \
+        lua_pushboolean(L, B(n(w, d)));     \
+        return 1;                           \
+    }
+
+#define LCW_YX(n)                           \
+    static int lcw_ ## n(lua_State *L)      \
+    {                                       \
+        WINDOW *w = lcw_check(L, 1);        \
+        int y, x;                           \
+        n(w, y, x);                         \
+        lua_pushnumber(L, y);               \
+        lua_pushnumber(L, x);               \
+        return 2;                           \
+    }
+
 
 static int lc_map_keyboard(lua_State *L)
 {
@@ -124,14 +219,32 @@ static int lc_map_keyboard(lua_State *L)
 ** privates
 ** =======================================================
 */
+/*
+** a window userdata. backing is the pad window:resize_keep keeps the
+** cells in, of which w is then a subpad. sub windows count themselves
+** in their parent, which they keep alive in their uservalue: delwin
+** fails on a window that still has sub windows, so the parent must not
+** be collected (or closed) before them
+*/
+typedef struct lcwindow
+{
+    WINDOW *w;
+    WINDOW *backing;
+    struct lcwindow *parent;
+    int children;
+} lcwindow;
+
 static void lcw_new(lua_State *L, WINDOW *nw)
 {
     if (nw)
     {
-        WINDOW **w = lua_newuserdata(L, sizeof(WINDOW*));
+        lcwindow *w = lua_newuserdata(L, sizeof(lcwindow));
         luaL_getmetatable(L, WINDOWMETA);
         lua_setmetatable(L, -2);
-        *w = nw;
+        w->w = nw;
+        w->backing = NULL;
+        w->parent = NULL;
+        w->children = 0;
     }
     else
     {
@@ -154,6 +267,19 @@ static WINDOW *lcw_check(lua_State *L, int index)
     return *w;
 }
 
+/* like lcw_new, for a sub window of the window at index parent */
+static void lcw_new_sub(lua_State *L, WINDOW *nw, int parent)
+{
+    lcwindow *w, *pw = (lcwindow*)lcw_get(L, parent);
+
+    lcw_new(L, nw);
+    w = (lcwindow*)lua_touserdata(L, -1);
+    w->parent = pw;
+    pw->children++;
+    lua_pushvalue(L, parent);
+    lua_setuservalue(L, -2);
+}
+
 static int lcw_tostring(lua_State *L)
 {
     WINDOW **w = lcw_get(L, 1);
@@ -171,15 +297,30 @@ static int lcw_tostring(lua_State *L)
 ** cchar_t handling
 ** =======================================================
 */
+static size_t lc_utf8_next(const unsigned char *s, const unsigned char *e,
+                           wchar_t *cp);
+
+/*
+** a character is a chtype number, whose attribute bits (A_ALTCHARSET
+** for the ACS_ characters) go to the attributes of the cell, or the
+** first character of an utf-8 string
+*/
 static cchar_t lc_checkch(lua_State *L, int index)
 {
   cchar_t r = {.attr = 0 };
-  if (lua_type(L, index) == LUA_TNUMBER)
-    r.chars[0] = luaL_checknumber(L, index);
+  if (lua_type(L, index) == LUA_TNUMBER) {
+    chtype c = (chtype)luaL_checknumber(L, index);
+    r.chars[0] = c & A_CHARTEXT;
+    r.attr = c & A_ATTRIBUTES;
     return r;
-  if (lua_type(L, index) == LUA_TSTRING)
-    r.chars[0] = *lua_tostring(L, index);
+  }
+  if (lua_type(L, index) == LUA_TSTRING) {
+    size_t len;
+    const unsigned char *s = (const unsigned char*)lua_tolstring(L, index, &len);
+    if (len > 0 && lc_utf8_next(s, s + len, &r.chars[0]) == 0)
+      luaL_argerror(L, index, "invalid UTF-8 code");
     return r;
+  }
 
   luaL_error(L, "type error");
   /* never executes */
@@ -202,6 +343,242 @@ static chtype lc_opt_chtype(lua_State *L, int index, chtype def) {
   return lua_isnoneornil(L, index) ? def : lc_checkchtype(L, index);
 }
 
+/*
+** =======================================================
+** utf-8 decoding
+** =======================================================
+*/
+
+/* high bit of every byte in a 64 bit word */
+#define UTF8_HIGHBITS   0x8080808080808080ULL
+
+/*
+** decode one utf-8 sequence (s < e). returns the number of bytes used,
+** or 0 if the sequence is invalid (truncated, overlong, surrogate or
+** beyond U+10FFFF) - the same rules the utf8 library applies
+*/
+static size_t lc_utf8_next(const unsigned char *s, const unsigned char *e,
+                           wchar_t *cp)
+{
+    unsigned int c = s[0];
+    unsigned int res;
+    size_t n, i;
+
+    if (c < 0x80) {
+        *cp = c;
+        return 1;
+    }
+    else if (c < 0xC2)      /* continuation byte or overlong 2 byte form */
+        return 0;
+    else if (c < 0xE0) {
+        n = 2; res = c & 0x1F;
+    }
+    else if (c < 0xF0) {
+        n = 3; res = c & 0x0F;
+    }
+    else if (c < 0xF5) {
+        n = 4; res = c & 0x07;
+    }
+    else
+        return 0;
+
+    if ((size_t)(e - s) < n)
+        return 0;
+    for (i = 1; i < n; i++) {
+        if ((s[i] & 0xC0) != 0x80)
+            return 0;
+        res = (res << 6) | (s[i] & 0x3F);
+    }
+
+    /* overlong forms, surrogates and out of range values */
+    if ((n == 3 && res < 0x800) || (n == 4 && res < 0x10000) ||
+        (res >= 0xD800 && res <= 0xDFFF) || res > 0x10FFFF)
+        return 0;
+
+    *cp = res;
+    return n;
+}
+
+/*
+** decode the utf-8 text str into at most max cells of out. each
+** decoded cell gets the codepoint in chars[0] and the attribute attr,
+** the rest of the cell is left untouched.
+** runs of ascii text are checked 8 bytes at a time.
+** returns the number of cells written or -1 on invalid input
+*/
+static int lc_utf8_to_cchar(const char *str, size_t len, cchar_t *out,
+                            int max, attr_t attr)
+{
+    const unsigned char *s = (const unsigned char*)str;
+    const unsigned char *e = s + len;
+    int i = 0;
+
+    while (s < e && i < max) {
+        /* fast path: 8 ascii characters */
+        if (e - s >= 8 && max - i >= 8) {
+            uint64_t word;
+            memcpy(&word, s, sizeof(word));
+            if ((word & UTF8_HIGHBITS) == 0) {
+                int k;
+                for (k = 0; k < 8; k++) {
+                    out[i + k].chars[0] = s[k];
+                    out[i + k].attr = attr;
+                }
+                i += 8;
+                s += 8;
+                continue;
+            }
+        }
+
+        {
+            wchar_t cp;
+            size_t n = lc_utf8_next(s, e, &cp);
+            if (n == 0)
+                return -1;
+            out[i].chars[0] = cp;
+            out[i++].attr = attr;
+            s += n;
+        }
+    }
+    return i;
+}
+
+/* encode codepoint cp as utf-8 into buf. returns the number of bytes */
+static int lc_utf8_encode(char *buf, unsigned long cp)
+{
+    if (cp < 0x80) {
+        buf[0] = (char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        buf[0] = (char)(0xC0 | (cp >> 6));
+        buf[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        buf[0] = (char)(0xE0 | (cp >> 12));
+        buf[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        buf[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    buf[0] = (char)(0xF0 | (cp >> 18));
+    buf[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+    buf[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    buf[3] = (char)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+/*
+** =======================================================
+** scratch arena
+** =======================================================
+*/
+
+/*
+** one grow-only cchar_t buffer per lua state, kept in the registry
+** and freed with the state. cells are zeroed when the buffer grows
+** and users only ever write chars[0] and attr, so the remaining
+** fields of every cell stay clear between uses. code that needs raw
+** memory instead takes the separate byte buffer, which has no such rule
+*/
+typedef struct
+{
+    cchar_t *cells;
+    size_t size;                /* in cells */
+    void *bytes;
+    size_t nbytes;
+    unsigned long allocs;       /* number of times a buffer grew */
+} scratch;
+
+static int scratch_gc(lua_State *L)
+{
+    scratch *s = (scratch*)lua_touserdata(L, 1);
+    free(s->cells);
+    free(s->bytes);
+    s->cells = NULL;
+    s->bytes = NULL;
+    s->size = s->nbytes = 0;
+    return 0;
+}
+
+static scratch *lc_getscratch(lua_State *L)
+{
+    scratch *s;
+    lua_getfield(L, LUA_REGISTRYINDEX, SCRATCH_REGISTRY);
+    s = (scratch*)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    return s;
+}
+
+/* return a buffer of at least n cells, valid until the next call */
+static cchar_t *lc_scratch(lua_State *L, size_t n)
+{
+    scratch *s = lc_getscratch(L);
+
+    if (n > s->size)
+    {
+        size_t size = s->size ? s->size : 256;
+        cchar_t *cells;
+
+        while (size < n) size *= 2;
+        cells = realloc(s->cells, size * sizeof(cchar_t));
+        if (cells == NULL)
+            luaL_error(L, "not enough memory");
+        memset(cells + s->size, 0, (size - s->size) * sizeof(cchar_t));
+        s->cells = cells;
+        s->size = size;
+        s->allocs++;
+    }
+    return s->cells;
+}
+
+/* return n bytes of raw memory, valid until the next call */
+static void *lc_scratch_bytes(lua_State *L, size_t n)
+{
+    scratch *s = lc_getscratch(L);
+
+    if (n > s->nbytes)
+    {
+        size_t size = s->nbytes ? s->nbytes : 4096;
+        void *bytes;
+
+        while (size < n) size *= 2;
+        bytes = realloc(s->bytes, size);
+        if (bytes == NULL)
+            luaL_error(L, "not enough memory");
+        s->bytes = bytes;
+        s->nbytes = size;
+        s->allocs++;
+    }
+    return s->bytes;
+}
+
+static void lc_newscratch(lua_State *L)
+{
+    scratch *s = lua_newuserdata(L, sizeof(scratch));
+    s->cells = NULL;
+    s->size = 0;
+    s->bytes = NULL;
+    s->nbytes = 0;
+    s->allocs = 0;
+
+    lua_newtable(L);
+    lua_pushcfunction(L, scratch_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_setmetatable(L, -2);
+
+    lua_setfield(L, LUA_REGISTRYINDEX, SCRATCH_REGISTRY);
+}
+
+/* allocation count and size in bytes of the scratch buffers */
+static int lc_scratch_stats(lua_State *L)
+{
+    scratch *s = lc_getscratch(L);
+    lua_pushnumber(L, s->allocs);
+    lua_pushnumber(L, s->size * sizeof(cchar_t) + s->nbytes);
+    return 2;
+}
+
 /*
 ** =======================================================
 ** chstr handling
@@ -209,23 +586,142 @@ static chtype lc_opt_chtype(lua_State *L, int index, chtype def) {
 */
 typedef struct
 {
-    unsigned int len;
-    cchar_t str[1];
+    unsigned int len;           /* cells in use */
+    unsigned int cap;           /* cells of the buffer */
+    cchar_t *str;
 } chstr;
-#define CHSTR_SIZE(len) (sizeof(chstr) + len * sizeof(cchar_t))
 
+/*
+** cell buffers come in size classes of 16, 32, 64... cells. buffers of
+** collected chstr objects are kept per class and handed out again, up
+** to CHSTR_KEEP of each. larger buffers are allocated exactly and freed.
+** the pool is kept per lua state in the registry, like the scratch
+** arena, and the pooled buffers are freed with the state
+*/
+#define CHSTR_MINCAP    16
+#define CHSTR_CLASSES   16
+#define CHSTR_KEEP      16
+
+typedef struct
+{
+    cchar_t *free[CHSTR_CLASSES][CHSTR_KEEP];
+    int nfree[CHSTR_CLASSES];
+    int closed;                 /* state closing, free released buffers */
+    unsigned long created;      /* chstr objects */
+    unsigned long allocs;       /* buffers allocated */
+    unsigned long reused;       /* buffers taken from the pool */
+    unsigned long live;         /* buffers in use */
+} chstr_pool;
+
+/* chstr objects may still be finalized after it, when the state closes */
+static int chstr_pool_gc(lua_State *L)
+{
+    chstr_pool *pool = (chstr_pool*)lua_touserdata(L, 1);
+    int c;
+
+    for (c = 0; c < CHSTR_CLASSES; c++)
+        while (pool->nfree[c] > 0)
+            free(pool->free[c][--pool->nfree[c]]);
+    pool->closed = 1;
+    return 0;
+}
+
+static chstr_pool *lc_getchstrs(lua_State *L)
+{
+    chstr_pool *pool;
+    lua_getfield(L, LUA_REGISTRYINDEX, CHSTRS_REGISTRY);
+    pool = (chstr_pool*)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    return pool;
+}
+
+static void lc_newchstrs(lua_State *L)
+{
+    chstr_pool *pool = lua_newuserdata(L, sizeof(chstr_pool));
+    memset(pool, 0, sizeof(chstr_pool));
+
+    lua_newtable(L);
+    lua_pushcfunction(L, chstr_pool_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_setmetatable(L, -2);
+
+    lua_setfield(L, LUA_REGISTRYINDEX, CHSTRS_REGISTRY);
+}
+
+/* size class of a buffer of len cells, -1 if too large for the pool */
+static int chstr_class(unsigned int len)
+{
+    int c = 0;
+    while (c < CHSTR_CLASSES && (CHSTR_MINCAP << c) < len)
+        c++;
+    return c < CHSTR_CLASSES ? c : -1;
+}
+
+/* a buffer of at least len cells, all clear. its size is set in cap */
+static cchar_t *chstr_alloc(lua_State *L, unsigned int len, unsigned int *cap)
+{
+    chstr_pool *pool = lc_getchstrs(L);
+    int c = chstr_class(len);
+    cchar_t *p;
+
+    *cap = c < 0 ? len : CHSTR_MINCAP << c;
+    if (c >= 0 && pool->nfree[c] > 0)
+    {
+        p = pool->free[c][--pool->nfree[c]];
+        memset(p, 0, *cap * sizeof(cchar_t));
+        pool->reused++;
+    }
+    else
+    {
+        p = calloc(*cap, sizeof(cchar_t));
+        if (p == NULL)
+            luaL_error(L, "not enough memory");
+        pool->allocs++;
+    }
+    pool->live++;
+    return p;
+}
+
+static void chstr_release(lua_State *L, cchar_t *p, unsigned int cap)
+{
+    chstr_pool *pool;
+    int c = chstr_class(cap);
+
+    if (p == NULL)
+        return;
+    pool = lc_getchstrs(L);
+    pool->live--;
+    if (!pool->closed && c >= 0 && (CHSTR_MINCAP << c) == cap &&
+        pool->nfree[c] < CHSTR_KEEP)
+        pool->free[c][pool->nfree[c]++] = p;
+    else
+        free(p);
+}
+
+static int chstr_gc(lua_State *L)
+{
+    chstr *cs = (chstr*)lua_touserdata(L, 1);
+    chstr_release(L, cs->str, cs->cap);
+    cs->str = NULL;
+    cs->len = cs->cap = 0;
+    return 0;
+}
 
-/* create new chstr object and leave it in the lua stack */
+/* create new chstr object, all cells clear, and leave it in the lua stack */
 static chstr* chstr_new(lua_State *L, int len)
 {
   if (len < 1) {
     lua_pushliteral(L, "invalid chstr length");
     lua_error(L);
   }
-  chstr *cs = lua_newuserdata(L, CHSTR_SIZE(len));
+  chstr *cs = lua_newuserdata(L, sizeof(chstr));
+  cs->str = NULL;
+  cs->len = cs->cap = 0;
   luaL_getmetatable(L, CHSTRMETA);
   lua_setmetatable(L, -2);
+  cs->str = chstr_alloc(L, len, &cs->cap);
   cs->len = len;
+  lc_getchstrs(L)->created++;
   return cs;
 }
 
@@ -243,45 +739,116 @@ static chstr* lc_checkchstr(lua_State *L, int index)
 static int lc_new_chstr(lua_State *L)
 {
   int len = luaL_checkinteger(L, 1);
-  chstr* ncs = chstr_new(L, len);
-  memset(ncs->str, 0, len * sizeof(cchar_t));
+  chstr_new(L, len);
   return 1;
 }
 
-/* change the contents of the chstr */
-static int chstr_set_str(lua_State *L) {
+/*
+** chstr:resize(len)
+** change the length, keeping the cells that fit. new cells are clear.
+** the buffer is replaced only when it is too small
+*/
+static int chstr_resize(lua_State *L)
+{
   chstr *cs = lc_checkchstr(L, 1);
-  int index = luaL_checkinteger(L, 2);
+  int len = luaL_checkinteger(L, 2);
+
+  luaL_argcheck(L, len > 0, 2, "invalid chstr length");
+  if ((unsigned int)len > cs->cap) {
+    unsigned int cap;
+    cchar_t *p = chstr_alloc(L, len, &cap);
+    memcpy(p, cs->str, cs->len * sizeof(cchar_t));
+    chstr_release(L, cs->str, cs->cap);
+    cs->str = p;
+    cs->cap = cap;
+  }
+  else if ((unsigned int)len > cs->len)
+    memset(cs->str + cs->len, 0, (len - cs->len) * sizeof(cchar_t));
+  cs->len = len;
+  return 0;
+}
 
-  attr_t attr = (attr_t)luaL_optnumber(L, 4, A_NORMAL);
+/* chstr:clear(): make every cell clear, as in a new chstr */
+static int chstr_clear(lua_State *L)
+{
+  chstr *cs = lc_checkchstr(L, 1);
+  memset(cs->str, 0, cs->len * sizeof(cchar_t));
+  return 0;
+}
 
-  int i = 0;
+/*
+** created, allocated, reused, live, pooled = curses.chstr_stats()
+** chstr objects created, cell buffers allocated and taken from the
+** pool, buffers in use and buffers waiting in the pool
+*/
+static int lc_chstr_stats(lua_State *L)
+{
+  chstr_pool *pool = lc_getchstrs(L);
+  int c, pooled = 0;
+  for (c = 0; c < CHSTR_CLASSES; c++)
+    pooled += pool->nfree[c];
+
+  lua_pushnumber(L, pool->created);
+  lua_pushnumber(L, pool->allocs);
+  lua_pushnumber(L, pool->reused);
+  lua_pushnumber(L, pool->live);
+  lua_pushnumber(L, pooled);
+  return 5;
+}
 
-  if (index < 0) return 0;
+/*
+** repeat the n cells at index until count cells are filled, doubling
+** the copied block every time. stops at the end of the chstr
+*/
+static void chstr_repeat(chstr *cs, int index, int n, lua_Integer count)
+{
+  cchar_t *p = cs->str + index;
+  int done = n;
 
-  int n = lua_gettop(L);
-  lua_getglobal(L, "utf8");
-  lua_getfield(L, -1, "codes");
-  lua_remove(L, -2); // remove global utf8
-  lua_pushvalue(L, 3);
+  if (count > (lua_Integer)(cs->len - index))
+    count = cs->len - index;
+  while (done < count) {
+    int k = done < count - done ? done : (int)(count - done);
+    memcpy(p + done, p, k * sizeof(cchar_t));
+    done += k;
+  }
+}
 
-  lua_call(L, 1, LUA_MULTRET);
-  while (1) {
-    lua_pushvalue(L, -3);
-    lua_insert(L, -3);
-    lua_pushvalue(L, -2);
-    lua_insert(L, -4);
+/* first cell and number of cells of a range, clipped to the chstr */
+static int chstr_range(lua_State *L, chstr *cs, int arg, int *index)
+{
+  lua_Integer i = luaL_optinteger(L, arg, 0);
+  lua_Integer n = luaL_optinteger(L, arg + 1, (lua_Integer)cs->len - i);
 
-    lua_call(L, 2, LUA_MULTRET);
-    if (lua_gettop(L) == n + 2) {
-      lua_pop(L, 2);
-      break;
-    } else {
-      cs->str[i].chars[0] = lua_tointeger(L, -1);
-      cs->str[i++].attr = attr;
-      lua_pop(L, 1);
-    }
+  if (i < 0) {
+    n += i;
+    i = 0;
   }
+  if (i > cs->len)
+    i = cs->len;
+  if (n > (lua_Integer)cs->len - i)
+    n = cs->len - i;
+  *index = (int)i;
+  return n > 0 ? (int)n : 0;
+}
+
+/* change the contents of the chstr */
+static int chstr_set_str(lua_State *L) {
+  chstr *cs = lc_checkchstr(L, 1);
+  int index = luaL_checkinteger(L, 2);
+  size_t len;
+  const char *str = luaL_checklstring(L, 3, &len);
+  attr_t attr = (attr_t)luaL_optnumber(L, 4, A_NORMAL);
+  lua_Integer rep = luaL_optinteger(L, 5, 1);
+  int n;
+
+  if (index < 0 || index >= cs->len) return 0;
+
+  n = lc_utf8_to_cchar(str, len, cs->str + index, cs->len - index, attr);
+  if (n < 0)
+    luaL_error(L, "invalid UTF-8 code");
+  if (rep > 1 && n > 0)
+    chstr_repeat(cs, index, n, rep > cs->len / n + 1 ? cs->len : n * rep);
 
   return 0;
 }
@@ -292,13 +859,76 @@ static int chstr_set_ch(lua_State *L)
   chstr* cs = lc_checkchstr(L, 1);
   int index = luaL_checkinteger(L, 2);
   cchar_t ch = lc_checkch(L, 3);
-  int attr = (chtype)luaL_optnumber(L, 4, A_NORMAL);
+  attr_t attr = (attr_t)luaL_optnumber(L, 4, A_NORMAL);
+  lua_Integer rep = luaL_optinteger(L, 5, 1);
+
+  if (index < 0 || index >= cs->len) return 0;
 
+  ch.attr |= attr;
   cs->str[index] = ch;
-  cs->str[index].attr = attr;
+  if (rep > 1)
+    chstr_repeat(cs, index, 1, rep);
   return 0;
 }
 
+/*
+** chstr:set_attr(attr [, index [, count]])
+** change the attributes of a range of cells, keeping their characters
+*/
+static int chstr_set_attr(lua_State *L)
+{
+  chstr *cs = lc_checkchstr(L, 1);
+  attr_t attr = (attr_t)luaL_checknumber(L, 2);
+  int index, i;
+  int n = chstr_range(L, cs, 3, &index);
+  cchar_t *p = cs->str + index;
+
+  /* ACS characters keep their alternate character set */
+  for (i = 0; i < n; i++)
+    p[i].attr = (p[i].attr & A_ALTCHARSET) | attr;
+  return 0;
+}
+
+/*
+** n = chstr:blit(index, src [, src_index [, count]])
+** copy cells of src (which may be the same chstr) to index. returns
+** the number of cells copied
+*/
+static int chstr_blit(lua_State *L)
+{
+  chstr *cs = lc_checkchstr(L, 1);
+  int index = luaL_checkinteger(L, 2);
+  chstr *src = lc_checkchstr(L, 3);
+  int from;
+  int n = chstr_range(L, src, 4, &from);
+
+  if (index < 0 || index >= cs->len)
+    n = 0;
+  else if (n > cs->len - index)
+    n = cs->len - index;
+
+  memmove(cs->str + index, src->str + from, n * sizeof(cchar_t));
+  lua_pushnumber(L, n);
+  return 1;
+}
+
+/*
+** str = chstr:sub(index [, count])
+** new chstr with a copy of count cells from index
+*/
+static int chstr_sub(lua_State *L)
+{
+  chstr *cs = lc_checkchstr(L, 1);
+  int index;
+  int n = chstr_range(L, cs, 2, &index);
+  chstr *ncs;
+
+  luaL_argcheck(L, n > 0, 2, "empty range");
+  ncs = chstr_new(L, n);
+  memcpy(ncs->str, cs->str + index, n * sizeof(cchar_t));
+  return 1;
+}
+
 /* get information from the chstr */
 static int chstr_get(lua_State *L)
 {
@@ -450,22 +1080,322 @@ static void cleanup()
     }
 }
 
-static int lc_initscr(lua_State *L)
+/*
+** headless mode: a curses screen that reads keys from a pipe and writes
+** its output to a temporary file instead of a terminal
+*/
+static struct
 {
-    WINDOW *w;
-
-    /* initialize curses */
-    w = initscr();
+    SCREEN *scr;
+    FILE *out;          /* terminal output, read back by headless_output */
+    FILE *in;           /* read end of the input pipe */
+    int keys;           /* write end of the input pipe */
+    long pos;           /* output bytes already returned */
+} headless;
 
-    /* no longer used, so clean it up */
-    lua_pushstring(L, RIPOFF_TABLE);
-    lua_pushnil(L);
-    lua_settable(L, LUA_REGISTRYINDEX);
+/*
+** output coalescing: curses writes to its own descriptor for the
+** terminal. while a frame is drawn (curses.doupdate, window:refresh)
+** that descriptor is pointed at a temporary file, and the frame is then
+** sent to the terminal with a single write. everything else curses
+** writes, and the terminal modes, go straight to the terminal
+*/
+static struct
+{
+    SCREEN *scr;
+    int fd;             /* descriptor curses writes to */
+    int tty;            /* the terminal */
+    FILE *mem;          /* frame being drawn */
+    char *buf;
+    size_t size;
+    long mark;          /* headless output offset when the frame began */
+
+    unsigned long frames;
+    unsigned long bytes;
+    unsigned long escapes;  /* escape sequences */
+    unsigned long moves;    /* cursor movement sequences */
+    unsigned long writes;   /* writes to the terminal */
+} output;
+
+/* open curses on the terminal with coalesced output */
+static SCREEN *output_open(void)
+{
+    FILE *out;
+
+    if (!isatty(STDOUT_FILENO))
+        return NULL;
+    output.tty = dup(STDOUT_FILENO);
+    output.fd = dup(STDOUT_FILENO);
+    output.mem = tmpfile();
+    out = output.fd >= 0 ? fdopen(output.fd, "w") : NULL;
+    if (output.tty >= 0 && output.mem != NULL && out != NULL)
+        output.scr = newterm(NULL, out, stdin);
+
+    if (output.scr == NULL)
+    {
+        if (out != NULL) fclose(out);
+        else if (output.fd >= 0) close(output.fd);
+        if (output.tty >= 0) close(output.tty);
+        if (output.mem != NULL) fclose(output.mem);
+        output.mem = NULL;
+    }
+    return output.scr;
+}
+
+/* make room for n bytes of frame */
+static char *output_buffer(size_t n)
+{
+    if (n > output.size)
+    {
+        size_t size = output.size ? output.size : 16384;
+        char *buf;
+
+        while (size < n) size *= 2;
+        buf = realloc(output.buf, size);
+        if (buf == NULL)
+            return NULL;
+        output.buf = buf;
+        output.size = size;
+    }
+    return output.buf;
+}
+
+/* count the escape sequences and cursor movements of a frame */
+static void output_count(const char *s, size_t n)
+{
+    const char *e = s + n;
+
+    output.frames++;
+    output.bytes += n;
+    while ((s = memchr(s, 27, e - s)) != NULL)
+    {
+        output.escapes++;
+        if (++s < e && *s == '[')
+        {
+            while (++s < e && ((*s >= '0' && *s <= '9') || *s == ';' || *s == '?'))
+                ;
+            if (s < e && strchr("ABCDGHdf", *s) != NULL)
+                output.moves++;
+        }
+    }
+}
+
+/* send n bytes of frame to the terminal */
+static void output_write(const char *s, size_t n)
+{
+    while (n > 0)
+    {
+        ssize_t w = write(output.tty, s, n);
+        output.writes++;
+        if (w > 0)
+        {
+            s += w;
+            n -= w;
+        }
+        else if (w < 0 && errno == EAGAIN)
+        {
+            struct pollfd fd;
+            fd.fd = output.tty;
+            fd.events = POLLOUT;
+            poll(&fd, 1, -1);
+        }
+        else if (w < 0 && errno != EINTR)
+            break;
+    }
+}
+
+/* start a frame: curses output goes to the frame file */
+static void output_begin(void)
+{
+    if (headless.scr != NULL)
+    {
+        fflush(headless.out);
+        output.mark = lseek(fileno(headless.out), 0, SEEK_END);
+    }
+    else if (output.scr != NULL && output.mem != NULL)
+    {
+        if (dup2(fileno(output.mem), output.fd) < 0)
+            output.mark = -1;
+        else
+            output.mark = 0;
+    }
+}
+
+/* end a frame: send it to the terminal, or count the headless output */
+static void output_end(void)
+{
+    long end;
+    int from;
+    char *buf;
+
+    if (headless.scr != NULL)
+    {
+        from = fileno(headless.out);
+        end = lseek(from, 0, SEEK_END);
+    }
+    else if (output.scr != NULL && output.mem != NULL && output.mark == 0)
+    {
+        from = fileno(output.mem);
+        end = lseek(from, 0, SEEK_CUR);
+        dup2(output.tty, output.fd);
+    }
+    else
+        return;
+
+    if (end <= output.mark)
+        return;
+    buf = output_buffer(end - output.mark);
+    if (buf == NULL || pread(from, buf, end - output.mark, output.mark) != end - output.mark)
+        return;
+    output_count(buf, end - output.mark);
+
+    if (headless.scr == NULL)
+    {
+        output_write(buf, end - output.mark);
+        if (ftruncate(from, 0) == 0)
+            lseek(from, 0, SEEK_SET);
+    }
+}
+
+/*
+** frames, bytes, escapes, moves, writes = curses.output_stats([reset])
+** frames drawn with output, the bytes, escape sequences and cursor
+** movements in them, and the writes that sent them to the terminal
+*/
+static int lc_output_stats(lua_State *L)
+{
+    lua_pushnumber(L, output.frames);
+    lua_pushnumber(L, output.bytes);
+    lua_pushnumber(L, output.escapes);
+    lua_pushnumber(L, output.moves);
+    lua_pushnumber(L, output.writes);
+    if (lua_toboolean(L, 1))
+        output.frames = output.bytes = output.escapes = output.moves =
+            output.writes = 0;
+    return 5;
+}
+
+/*
+** color pair cache: pairs are allocated on demand for each (fg, bg)
+** combination, found again through a hash table and, once all pairs
+** are taken, the least recently requested one is reused. pair 0 is
+** the terminal default and doubles as the list terminator. the cache
+** is kept per lua state in the registry and emptied whenever a screen
+** is created, as a new screen has no pairs defined
+*/
+
+/* pair numbers that fit in the A_COLOR bits of the attributes */
+#define COLOR_MAXPAIRS  255
+#define COLOR_BUCKETS   256
+
+typedef struct
+{
+    int fg[COLOR_MAXPAIRS + 1];
+    int bg[COLOR_MAXPAIRS + 1];
+    unsigned char chain[COLOR_MAXPAIRS + 1];    /* next pair in bucket */
+    unsigned char prev[COLOR_MAXPAIRS + 1];     /* lru list */
+    unsigned char next[COLOR_MAXPAIRS + 1];
+    unsigned char bucket[COLOR_BUCKETS];
+    int head, tail;                             /* most/least recent */
+    int used;
+    unsigned long hits, misses, evictions;
+} color_cache;
+
+static color_cache *lc_getcolors(lua_State *L)
+{
+    color_cache *c;
+    lua_getfield(L, LUA_REGISTRYINDEX, COLORS_REGISTRY);
+    c = (color_cache*)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    return c;
+}
+
+static void lc_newcolors(lua_State *L)
+{
+    color_cache *c = lua_newuserdata(L, sizeof(color_cache));
+    memset(c, 0, sizeof(color_cache));
+    lua_setfield(L, LUA_REGISTRYINDEX, COLORS_REGISTRY);
+}
+
+/* forget every pair, for a new screen. the counters are kept */
+static void color_reset(lua_State *L)
+{
+    color_cache *c = lc_getcolors(L);
+    unsigned long hits = c->hits, misses = c->misses, evictions = c->evictions;
+
+    memset(c, 0, sizeof(color_cache));
+    c->hits = hits;
+    c->misses = misses;
+    c->evictions = evictions;
+}
+
+static unsigned color_hash(int fg, int bg)
+{
+    return ((unsigned)fg * 0x9E3779B1u ^ (unsigned)bg) % COLOR_BUCKETS;
+}
+
+static void color_unlink(color_cache *c, int p)
+{
+    if (c->prev[p]) c->next[c->prev[p]] = c->next[p];
+    else c->head = c->next[p];
+    if (c->next[p]) c->prev[c->next[p]] = c->prev[p];
+    else c->tail = c->prev[p];
+}
+
+static void color_push(color_cache *c, int p)
+{
+    c->prev[p] = 0;
+    c->next[p] = c->head;
+    if (c->head) c->prev[c->head] = p;
+    else c->tail = p;
+    c->head = p;
+}
+
+/* add pair p to the bucket of its colors */
+static void color_hash_in(color_cache *c, int p)
+{
+    unsigned h = color_hash(c->fg[p], c->bg[p]);
+    c->chain[p] = c->bucket[h];
+    c->bucket[h] = p;
+}
+
+/* remove pair p from its hash bucket */
+static void color_unhash(color_cache *c, int p)
+{
+    unsigned char *q = &c->bucket[color_hash(c->fg[p], c->bg[p])];
+    while (*q != p)
+        q = &c->chain[*q];
+    *q = c->chain[p];
+}
+
+/* pair p was redefined by curses.init_pair: file it under its new colors */
+static void color_redefined(lua_State *L, int p, int fg, int bg)
+{
+    color_cache *c = lc_getcolors(L);
+
+    if (p < 1 || p > c->used)
+        return;
+    color_unhash(c, p);
+    c->fg[p] = fg;
+    c->bg[p] = bg;
+    color_hash_in(c, p);
+}
+
+/* common setup once curses is initialized with main window w */
+static int lc_main_window(lua_State *L, WINDOW *w)
+{
+    /* no longer used, so clean it up */
+    lua_pushstring(L, RIPOFF_TABLE);
+    lua_pushnil(L);
+    lua_settable(L, LUA_REGISTRYINDEX);
 
     /* failed to initialize */
     if (w == NULL)
         return 0;
 
+    /* pairs made for an earlier screen are not defined on this one */
+    color_reset(L);
+
     #if defined(NCURSES_VERSION)
     /* acomodate this value for cui keyboard handling */
     ESCDELAY = 0;
@@ -491,6 +1421,204 @@ static int lc_initscr(lua_State *L)
     return 1;
 }
 
+static int lc_initscr(lua_State *L)
+{
+    int coalesce = 1;
+
+    /* already running: hand out the same main window */
+    if (headless.scr != NULL || output.scr != NULL)
+    {
+        lua_pushstring(L, STDSCR_REGISTRY);
+        lua_rawget(L, LUA_REGISTRYINDEX);
+        return 1;
+    }
+
+    /* frames are sent to the terminal in one write unless asked not to */
+    if (!lua_isnoneornil(L, 1))
+    {
+        luaL_checktype(L, 1, LUA_TTABLE);
+        lua_getfield(L, 1, "coalesce");
+        coalesce = lua_isnil(L, -1) || lua_toboolean(L, -1);
+        lua_pop(L, 1);
+    }
+    if (coalesce && output.scr == NULL && output_open() != NULL)
+        return lc_main_window(L, stdscr);
+
+    /* initialize curses */
+    return lc_main_window(L, initscr());
+}
+
+/* close what a failed lc_init_headless opened, so it can be retried */
+static void headless_abort(int input)
+{
+    if (headless.in != NULL)
+        fclose(headless.in);
+    else
+        close(input);
+    if (headless.out != NULL)
+        fclose(headless.out);
+    close(headless.keys);
+    headless.in = headless.out = NULL;
+    headless.keys = -1;
+}
+
+/*
+** curses.init_headless{ lines = 24, cols = 80, term = 'xterm' }
+** initializes curses without a terminal. keys are fed with
+** curses.headless_input, the bytes curses writes are returned by
+** curses.headless_output and the resulting screen can be read back
+** with curses.screen_line and curses.screen_cell
+*/
+static int lc_init_headless(lua_State *L)
+{
+    int lines = 24, cols = 80;
+    const char *term = "xterm";
+    int fds[2];
+
+    if (!lua_isnoneornil(L, 1))
+    {
+        luaL_checktype(L, 1, LUA_TTABLE);
+        lua_getfield(L, 1, "lines");
+        lines = luaL_optinteger(L, -1, lines);
+        lua_getfield(L, 1, "cols");
+        cols = luaL_optinteger(L, -1, cols);
+        lua_getfield(L, 1, "term");
+        term = luaL_optstring(L, -1, term);
+        lua_pop(L, 3);
+    }
+    luaL_argcheck(L, lines > 0 && cols > 0, 1, "invalid screen size");
+
+    if (headless.scr != NULL || (stdscr != NULL && !isendwin()))
+        return luaL_error(L, "curses is already initialized");
+
+    if (pipe(fds) != 0)
+        return luaL_error(L, "cannot create input pipe");
+    headless.out = tmpfile();
+    headless.in = fdopen(fds[0], "r");
+    headless.keys = fds[1];
+    headless.pos = 0;
+    if (headless.out == NULL || headless.in == NULL)
+    {
+        headless_abort(fds[0]);
+        return luaL_error(L, "cannot create headless streams");
+    }
+
+    headless.scr = newterm(term, headless.out, headless.in);
+    if (headless.scr == NULL)
+    {
+        headless_abort(fds[0]);
+        return luaL_error(L, "unknown terminal type '%s'", term);
+    }
+    resize_term(lines, cols);
+
+    return lc_main_window(L, stdscr);
+}
+
+/* queue str as keyboard input for a headless screen */
+static int lc_headless_input(lua_State *L)
+{
+    size_t len;
+    const char *str = luaL_checklstring(L, 1, &len);
+    if (headless.scr == NULL)
+        return luaL_error(L, "curses is not running headless");
+
+    lua_pushboolean(L, write(headless.keys, str, len) == (ssize_t)len);
+    return 1;
+}
+
+/* return the bytes curses wrote to the terminal since the last call */
+static int lc_headless_output(lua_State *L)
+{
+    luaL_Buffer b;
+    char *p;
+    long end;
+    size_t n;
+
+    if (headless.scr == NULL)
+        return luaL_error(L, "curses is not running headless");
+
+    fflush(headless.out);
+    end = ftell(headless.out);
+    fseek(headless.out, headless.pos, SEEK_SET);
+
+    luaL_buffinit(L, &b);
+    while (headless.pos < end)
+    {
+        p = luaL_prepbuffer(&b);
+        n = fread(p, 1, LUAL_BUFFERSIZE, headless.out);
+        if (n == 0)
+            break;
+        luaL_addsize(&b, n);
+        headless.pos += n;
+    }
+    fseek(headless.out, end, SEEK_SET);
+    luaL_pushresult(&b);
+    return 1;
+}
+
+/*
+** the physical screen as curses last left it: curscr holds what was
+** sent to the terminal by the last curses.doupdate
+*/
+static int lc_screen_line(lua_State *L)
+{
+    int y = luaL_checkinteger(L, 1);
+    int x, cols = getmaxx(curscr);
+    luaL_Buffer b;
+
+    luaL_argcheck(L, y >= 0 && y < getmaxy(curscr), 1, "row out of range");
+
+    luaL_buffinit(L, &b);
+    for (x = 0; x < cols; x++)
+    {
+        cchar_t c;
+        wchar_t wch[CCHARW_MAX + 1];
+        attr_t attrs;
+        short pair;
+        char buf[4];
+        int i;
+
+        if (mvwin_wch(curscr, y, x, &c) == ERR ||
+            getcchar(&c, wch, &attrs, &pair, NULL) == ERR)
+            break;
+
+        for (i = 0; wch[i] != 0; i++)
+            luaL_addlstring(&b, buf, lc_utf8_encode(buf, wch[i]));
+
+        /* wide characters cover the next column too */
+        if (wch[0] != 0 && wcwidth(wch[0]) == 2)
+            x++;
+    }
+    luaL_pushresult(&b);
+    return 1;
+}
+
+/* character, attributes and color pair of one screen cell */
+static int lc_screen_cell(lua_State *L)
+{
+    int y = luaL_checkinteger(L, 1);
+    int x = luaL_checkinteger(L, 2);
+    cchar_t c;
+    wchar_t wch[CCHARW_MAX + 1];
+    attr_t attrs;
+    short pair;
+    char buf[4];
+    luaL_Buffer b;
+    int i;
+
+    if (mvwin_wch(curscr, y, x, &c) == ERR ||
+        getcchar(&c, wch, &attrs, &pair, NULL) == ERR)
+        return 0;
+
+    luaL_buffinit(L, &b);
+    for (i = 0; wch[i] != 0; i++)
+        luaL_addlstring(&b, buf, lc_utf8_encode(buf, wch[i]));
+    luaL_pushresult(&b);
+    lua_pushnumber(L, attrs & ~A_COLOR);
+    lua_pushnumber(L, pair);
+    return 3;
+}
+
 static int lc_endwin(lua_State *L)
 {
     endwin();
@@ -527,8 +1655,12 @@ static int lc_init_pair(lua_State *L)
     short pair = luaL_checkinteger(L, 1);
     short f = luaL_checkinteger(L, 2);
     short b = luaL_checkinteger(L, 3);
+    int ok = B(init_pair(pair, f, b));
 
-    lua_pushboolean(L, B(init_pair(pair, f, b)));
+    /* keep curses.make_color from handing out the old colors */
+    if (ok)
+        color_redefined(L, pair, f, b);
+    lua_pushboolean(L, ok);
     return 1;
 }
 
@@ -557,6 +1689,87 @@ static int lc_COLOR_PAIR(lua_State *L)
     return 1;
 }
 
+static int color_init_pair(int p, int fg, int bg)
+{
+#if defined(NCURSES_EXT_COLORS)
+    return init_extended_pair(p, fg, bg);
+#else
+    return init_pair(p, fg, bg);
+#endif
+}
+
+/*
+** attr = curses.make_color(fg, bg)
+** color pair attribute for the given foreground and background colors
+*/
+static int lc_make_color(lua_State *L)
+{
+    color_cache *c = lc_getcolors(L);
+    int fg = luaL_checkinteger(L, 1);
+    int bg = luaL_checkinteger(L, 2);
+    unsigned h = color_hash(fg, bg);
+    int max = COLOR_PAIRS - 1 < COLOR_MAXPAIRS ? COLOR_PAIRS - 1 : COLOR_MAXPAIRS;
+    int p;
+
+    if (!has_colors() || max < 1)
+    {
+        lua_pushnumber(L, 0);
+        return 1;
+    }
+
+    for (p = c->bucket[h]; p != 0; p = c->chain[p])
+    {
+        if (c->fg[p] == fg && c->bg[p] == bg)
+        {
+            c->hits++;
+            if (c->head != p)
+            {
+                color_unlink(c, p);
+                color_push(c, p);
+            }
+            lua_pushnumber(L, COLOR_PAIR(p));
+            return 1;
+        }
+    }
+
+    /* take a new pair or reuse the least recently requested one */
+    p = c->used < max ? c->used + 1 : c->tail;
+    if (color_init_pair(p, fg, bg) == ERR)
+        return luaL_error(L, "failed to initialize color pair (%d,%d,%d)",
+            p, fg, bg);
+
+    c->misses++;
+    if (p == c->used + 1)
+        c->used++;
+    else
+    {
+        color_unhash(c, p);
+        color_unlink(c, p);
+        c->evictions++;
+    }
+
+    c->fg[p] = fg;
+    c->bg[p] = bg;
+    color_hash_in(c, p);
+    color_push(c, p);
+
+    lua_pushnumber(L, COLOR_PAIR(p));
+    return 1;
+}
+
+/* hits, misses, evictions, pairs in use and pairs available */
+static int lc_color_stats(lua_State *L)
+{
+    color_cache *c = lc_getcolors(L);
+    int max = COLOR_PAIRS - 1 < COLOR_MAXPAIRS ? COLOR_PAIRS - 1 : COLOR_MAXPAIRS;
+    lua_pushnumber(L, c->hits);
+    lua_pushnumber(L, c->misses);
+    lua_pushnumber(L, c->evictions);
+    lua_pushnumber(L, c->used);
+    lua_pushnumber(L, max > 0 ? max : 0);
+    return 5;
+}
+
 /*
 ** =======================================================
 ** termattrs
@@ -615,6 +1828,11 @@ static int ripoffline_cb(WINDOW* w, int cols)
 
     lua_rawgeti(rip_L, -1, ++line); /* function to be called */
     lcw_new(rip_L, w);              /* create window object */
+
+    /* the window belongs to curses, keep it away from the collector */
+    lua_pushvalue(rip_L, -1);
+    lua_rawseti(rip_L, -4, -line);
+
     lua_pushnumber(rip_L, cols);    /* push number of columns */
 
     lua_pcall(rip_L, 2,  0, 0);     /* call the lua function */
@@ -678,52 +1896,1329 @@ static int lc_napms(lua_State *L)
     return 1;
 }
 
+/* file descriptor curses reads the keyboard from */
+static int lc_input_fd(void)
+{
+    return headless.scr != NULL ? fileno(headless.in) : STDIN_FILENO;
+}
+
+#define WAIT_MAXFDS     32
+
 /*
-** =======================================================
-** beep
-** =======================================================
+** reason, fd... = curses.wait_input([timeout_ms [, fd...]])
+**
+** block until there is keyboard input, one of the given file
+** descriptors is readable, a signal arrives (SIGWINCH on a terminal
+** resize) or timeout_ms milliseconds pass. a missing or negative
+** timeout waits forever. reason is "input", "fd", "signal" or
+** "timeout"; the readable descriptors follow it
 */
-LC_BOOLOK(beep)
-LC_BOOLOK(flash)
+static int lc_wait_input(lua_State *L)
+{
+    struct pollfd fds[WAIT_MAXFDS + 1];
+    int timeout = luaL_optinteger(L, 1, -1);
+    int nfds = lua_gettop(L) - 1;
+    int i, r, n = 0;
+
+    /* called without arguments: still wait on the keyboard */
+    if (nfds < 0)
+        nfds = 0;
+    luaL_argcheck(L, nfds <= WAIT_MAXFDS, WAIT_MAXFDS + 2,
+        "too many file descriptors");
+
+    fds[0].fd = lc_input_fd();
+    fds[0].events = POLLIN;
+    for (i = 1; i <= nfds; i++)
+    {
+        fds[i].fd = luaL_checkinteger(L, i + 1);
+        fds[i].events = POLLIN;
+    }
+
+    r = poll(fds, nfds + 1, timeout < 0 ? -1 : timeout);
+    if (r < 0)
+    {
+        if (errno != EINTR)
+            return luaL_error(L, "wait_input: %s", strerror(errno));
+        lua_pushliteral(L, "signal");
+        return 1;
+    }
+    if (r == 0)
+    {
+        lua_pushliteral(L, "timeout");
+        return 1;
+    }
 
+    if (fds[0].revents != 0)
+        lua_pushliteral(L, "input");
+    else
+        lua_pushliteral(L, "fd");
+    for (i = 1; i <= nfds; i++)
+    {
+        if (fds[i].revents != 0)
+        {
+            lua_pushnumber(L, fds[i].fd);
+            n++;
+        }
+    }
+    return n + 1;
+}
 
 /*
 ** =======================================================
-** window
+** timers
 ** =======================================================
 */
 
-static int lc_newwin(lua_State *L)
+/* milliseconds from an arbitrary point, never goes backwards */
+static long long lc_now_ms(void)
 {
-    int nlines  = luaL_checkinteger(L, 1);
-    int ncols   = luaL_checkinteger(L, 2);
-    int begin_y = luaL_checkinteger(L, 3);
-    int begin_x = luaL_checkinteger(L, 4);
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+** pending timers, a binary min-heap on the due time kept in a registry
+** userdata. timers are numbered from a counter that never goes back, so
+** an id is not reused once its timer is gone. callbacks live in a
+** registry table indexed by that id. timers due at the same time run in
+** the order they were added
+*/
+typedef struct
+{
+    long long due;      /* lc_now_ms time */
+    lua_Integer id;     /* callback in TIMER_CALLBACKS */
+    int interval;       /* ms between runs, 0 for a one shot timer */
+} timer;
+
+typedef struct
+{
+    timer *heap;
+    int n;
+    int size;
+    lua_Integer next_id;
+} timers;
+
+#define TIMER_BEFORE(a, b)  ((a).due < (b).due || \
+                             ((a).due == (b).due && (a).id < (b).id))
+
+static int timers_gc(lua_State *L)
+{
+    timers *t = (timers*)lua_touserdata(L, 1);
+    free(t->heap);
+    t->heap = NULL;
+    t->n = t->size = 0;
+    return 0;
+}
+
+static timers *lc_gettimers(lua_State *L)
+{
+    timers *t;
+    lua_getfield(L, LUA_REGISTRYINDEX, TIMER_REGISTRY);
+    t = (timers*)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    return t;
+}
+
+static void timers_up(timers *t, int i)
+{
+    timer e = t->heap[i];
+    while (i > 0 && TIMER_BEFORE(e, t->heap[(i - 1) / 2]))
+    {
+        t->heap[i] = t->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    t->heap[i] = e;
+}
+
+static void timers_down(timers *t, int i)
+{
+    timer e = t->heap[i];
+    for (;;)
+    {
+        int c = 2 * i + 1;
+        if (c >= t->n)
+            break;
+        if (c + 1 < t->n && TIMER_BEFORE(t->heap[c + 1], t->heap[c]))
+            c++;
+        if (!TIMER_BEFORE(t->heap[c], e))
+            break;
+        t->heap[i] = t->heap[c];
+        i = c;
+    }
+    t->heap[i] = e;
+}
+
+static void timers_push(lua_State *L, timers *t, timer e)
+{
+    if (t->n == t->size)
+    {
+        int size = t->size ? t->size * 2 : 16;
+        timer *heap = realloc(t->heap, size * sizeof(timer));
+        if (heap == NULL)
+            luaL_error(L, "not enough memory");
+        t->heap = heap;
+        t->size = size;
+    }
+    t->heap[t->n++] = e;
+    timers_up(t, t->n - 1);
+}
+
+static void timers_delete(timers *t, int i)
+{
+    t->heap[i] = t->heap[--t->n];
+    if (i < t->n)
+    {
+        timers_up(t, i);
+        timers_down(t, i);
+    }
+}
+
+/*
+** id = curses.timer_add(ms, fn [, periodic])
+** call fn once ms milliseconds from now, or every ms milliseconds if
+** periodic is true. timers only run from curses.timer_run
+*/
+static int lc_timer_add(lua_State *L)
+{
+    timers *t = lc_gettimers(L);
+    int ms = luaL_checkinteger(L, 1);
+    int periodic = lua_toboolean(L, 3);
+    timer e;
+
+    luaL_argcheck(L, ms >= 0, 1, "negative delay");
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+    luaL_argcheck(L, ms > 0 || !periodic, 1,
+        "periodic timer needs a positive interval");
+
+    e.id = t->next_id++;
+    e.due = lc_now_ms() + ms;
+    e.interval = periodic ? ms : 0;
+    timers_push(L, t, e);
+
+    lua_getfield(L, LUA_REGISTRYINDEX, TIMER_CALLBACKS);
+    lua_pushvalue(L, 2);
+    lua_rawseti(L, -2, e.id);
+
+    lua_pushnumber(L, e.id);
+    return 1;
+}
+
+/* cancel a timer. returns false if it was not pending */
+static int lc_timer_remove(lua_State *L)
+{
+    timers *t = lc_gettimers(L);
+    lua_Integer id = luaL_checkinteger(L, 1);
+    int i;
+
+    for (i = 0; i < t->n; i++)
+    {
+        if (t->heap[i].id == id)
+        {
+            timers_delete(t, i);
+            lua_getfield(L, LUA_REGISTRYINDEX, TIMER_CALLBACKS);
+            lua_pushnil(L);
+            lua_rawseti(L, -2, id);
+            lua_pushboolean(L, 1);
+            return 1;
+        }
+    }
+    lua_pushboolean(L, 0);
+    return 1;
+}
+
+/*
+** run the callbacks of every timer that is due, earliest first.
+** periodic timers are rescheduled before their callback runs, so a
+** callback may remove its own timer. timers added by the callbacks wait
+** for the next call, even when already due, so that a callback adding
+** itself again cannot keep the loop going. returns the number of
+** callbacks run
+*/
+static int lc_timer_run(lua_State *L)
+{
+    timers *t = lc_gettimers(L);
+    long long now = lc_now_ms();
+    lua_Integer added = t->next_id;
+    int ran = 0;
+
+    lua_getfield(L, LUA_REGISTRYINDEX, TIMER_CALLBACKS);
+    /* same due time runs in id order, so the first new timer ends it */
+    while (t->n > 0 && t->heap[0].due <= now && t->heap[0].id < added)
+    {
+        timer e = t->heap[0];
+
+        lua_rawgeti(L, -1, e.id);
+        if (e.interval > 0)
+        {
+            /* skip the runs that were missed, do not catch up */
+            t->heap[0].due = e.due + e.interval;
+            if (t->heap[0].due <= now)
+                t->heap[0].due = now + e.interval;
+            timers_down(t, 0);
+        }
+        else
+        {
+            timers_delete(t, 0);
+            lua_pushnil(L);
+            lua_rawseti(L, -3, e.id);
+        }
+
+        lua_call(L, 0, 0);
+        ran++;
+    }
+
+    lua_pushnumber(L, ran);
+    return 1;
+}
+
+/* milliseconds until the next timer is due (0 if late), nil if none */
+static int lc_timer_next(lua_State *L)
+{
+    timers *t = lc_gettimers(L);
+    long long ms;
+
+    if (t->n == 0)
+        return 0;
+
+    ms = t->heap[0].due - lc_now_ms();
+    lua_pushnumber(L, ms > 0 ? ms : 0);
+    return 1;
+}
+
+static void lc_newtimers(lua_State *L)
+{
+    timers *t = lua_newuserdata(L, sizeof(timers));
+    t->heap = NULL;
+    t->n = t->size = 0;
+    t->next_id = 1;
+
+    lua_newtable(L);
+    lua_pushcfunction(L, timers_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_setmetatable(L, -2);
+    lua_setfield(L, LUA_REGISTRYINDEX, TIMER_REGISTRY);
+
+    lua_newtable(L);
+    lua_setfield(L, LUA_REGISTRYINDEX, TIMER_CALLBACKS);
+}
+
+/*
+** =======================================================
+** keyboard decoding
+** =======================================================
+*/
+
+/* default time to wait for the key that follows Esc, in ms */
+#define ESC_DELAY       100
+
+/* names of the control characters (Ctrl-H, I, J and M have their own) */
+static const char *const ctrl_names[32] =
+{
+    NULL,       "CtrlA",    "CtrlB",    "CtrlC",
+    "CtrlD",    "CtrlE",    "CtrlF",    "CtrlG",
+    "Backspace","Tab",      "Enter",    "CtrlK",
+    "CtrlL",    "Enter",    "CtrlN",    "CtrlO",
+    "CtrlP",    "CtrlQ",    "CtrlR",    "CtrlS",
+    "CtrlT",    "CtrlU",    "CtrlV",    "CtrlW",
+    "CtrlX",    "CtrlY",    "CtrlZ",    "Escape",
+    NULL,       NULL,       NULL,       "CtrlBackspace",
+};
+
+/* name of a key code, NULL for printable characters and unknown keys */
+static const char *lc_key_name(int ch)
+{
+    if (ch >= 0 && ch < 32)
+        return ctrl_names[ch];
+
+    switch (ch)
+    {
+        case 127:           return "Backspace";
+        case KEY_DOWN:      return "Down";
+        case KEY_UP:        return "Up";
+        case KEY_LEFT:      return "Left";
+        case KEY_RIGHT:     return "Right";
+        case KEY_HOME:      return "Home";
+        case KEY_END:       return "End";
+        case KEY_NPAGE:     return "PageDown";
+        case KEY_PPAGE:     return "PageUp";
+        case KEY_IC:        return "Insert";
+        case KEY_DC:        return "Delete";
+        case KEY_BACKSPACE: return "Backspace";
+        case KEY_F(1):      return "F1";
+        case KEY_F(2):      return "F2";
+        case KEY_F(3):      return "F3";
+        case KEY_F(4):      return "F4";
+        case KEY_F(5):      return "F5";
+        case KEY_F(6):      return "F6";
+        case KEY_F(7):      return "F7";
+        case KEY_F(8):      return "F8";
+        case KEY_F(9):      return "F9";
+        case KEY_F(10):     return "F10";
+        case KEY_F(11):     return "F11";
+        case KEY_F(12):     return "F12";
+        case KEY_RESIZE:    return "Resize";
+        case KEY_BTAB:      return "ShiftTab";
+        case KEY_SDC:       return "ShiftDelete";
+        case KEY_SIC:       return "ShiftInsert";
+        case KEY_SEND:      return "ShiftEnd";
+        case KEY_SHOME:     return "ShiftHome";
+        case KEY_SLEFT:     return "ShiftLeft";
+        case KEY_SRIGHT:    return "ShiftRight";
+    }
+    return NULL;
+}
+
+/*
+** read one key from w. an Esc followed by another key within delay ms
+** is reported as that key with meta set, a lone Esc as code 27 named
+** "Esc". the wait for the second key is measured on the monotonic
+** clock while blocking on the input descriptor. returns 1 for a key,
+** 0 for a key without a name and -1 if there is no key
+*/
+static int lc_read_key(WINDOW *w, int delay, int *code, int *meta)
+{
+    int ch = wgetch(w);
+    if (ch == ERR)
+        return -1;
+
+    *meta = 0;
+    if (ch == 27)
+    {
+        ch = wgetch(w);
+        if (ch == ERR)
+        {
+            long long deadline = lc_now_ms() + delay;
+            long long left;
+            struct pollfd fd;
+
+            fd.fd = lc_input_fd();
+            fd.events = POLLIN;
+            while (ch == ERR && (left = deadline - lc_now_ms()) > 0)
+            {
+                if (poll(&fd, 1, (int)left) <= 0 && errno != EINTR)
+                    break;
+                ch = wgetch(w);
+            }
+            if (ch == ERR)
+            {
+                *code = 27;
+                return 1;
+            }
+        }
+        *meta = 1;
+        if (ch >= 'a' && ch <= 'z')
+            ch -= 32;
+    }
+
+    *code = ch;
+    return lc_key_name(ch) != NULL || ch < 256;
+}
+
+/* push the name of a key read by lc_read_key */
+static void lc_push_key_name(lua_State *L, int code, int meta)
+{
+    const char *name = lc_key_name(code);
+    char buf[2];
+
+    if (code == 27 && !meta)
+        name = "Esc";
+    else if (name == NULL)
+    {
+        buf[0] = (char)code;
+        buf[1] = 0;
+        name = buf;
+    }
+
+    if (meta)
+        lua_pushfstring(L, "Alt%s", name);
+    else
+        lua_pushstring(L, name);
+}
+
+/*
+** code, name, meta = curses.get_key(window [, esc_delay_ms])
+** read and decode one key. returns nothing if there is none
+*/
+static int lc_get_key(lua_State *L)
+{
+    WINDOW *w = lcw_check(L, 1);
+    int delay = luaL_optinteger(L, 2, ESC_DELAY);
+    int code, meta;
+
+    int r;
+
+    /* keys without a name are skipped */
+    while ((r = lc_read_key(w, delay, &code, &meta)) == 0)
+        ;
+    if (r < 0)
+        return 0;
+
+    lua_pushnumber(L, code);
+    lc_push_key_name(L, code, meta);
+    lua_pushboolean(L, meta);
+    return 3;
+}
+
+/*
+** n = curses.get_keys(window, t [, esc_delay_ms])
+** read every key that is already pending, storing code, name and meta
+** of key i at t[3*i-2], t[3*i-1] and t[3*i]. returns the number of keys
+*/
+static int lc_get_keys(lua_State *L)
+{
+    WINDOW *w = lcw_check(L, 1);
+    int delay = luaL_optinteger(L, 3, ESC_DELAY);
+    int code, meta, r;
+    int n = 0;
+
+    luaL_checktype(L, 2, LUA_TTABLE);
+
+    while ((r = lc_read_key(w, delay, &code, &meta)) >= 0)
+    {
+        if (r == 0)
+            continue;
+
+        lua_pushnumber(L, code);
+        lua_rawseti(L, 2, 3 * n + 1);
+        lc_push_key_name(L, code, meta);
+        lua_rawseti(L, 2, 3 * n + 2);
+        lua_pushboolean(L, meta);
+        lua_rawseti(L, 2, 3 * n + 3);
+        n++;
+    }
+
+    lua_pushnumber(L, n);
+    return 1;
+}
+
+/*
+** =======================================================
+** event queue
+** =======================================================
+*/
+#define QUEUE_LEVELS    3   /* urgent, normal, deferred */
+#define QUEUE_FIELDS    4   /* values kept per record */
+
+/*
+** each level is a ring of slot numbers. the values of a record live in
+** the uservalue table of the queue at slot * QUEUE_FIELDS + 1..4, and
+** slots are recycled, so the table stops growing once it holds as many
+** records as were ever pending at the same time
+*/
+typedef struct
+{
+    int *ring;
+    unsigned int head;
+    unsigned int count;
+    unsigned int size;      /* power of two */
+} queue_level;
+
+typedef struct
+{
+    queue_level level[QUEUE_LEVELS];
+    int *free;              /* recycled slots */
+    int nfree;
+    int nslots;             /* slots handed out so far */
+    int size;               /* capacity of free */
+    unsigned long posted;
+    unsigned long taken;
+} queue;
+
+static queue *lc_checkqueue(lua_State *L, int index)
+{
+    return (queue*)luaL_checkudata(L, index, QUEUEMETA);
+}
+
+static int queue_gc(lua_State *L)
+{
+    queue *q = lc_checkqueue(L, 1);
+    int i;
+
+    for (i = 0; i < QUEUE_LEVELS; i++)
+    {
+        free(q->level[i].ring);
+        q->level[i].ring = NULL;
+        q->level[i].count = q->level[i].size = 0;
+    }
+    free(q->free);
+    q->free = NULL;
+    q->nfree = q->nslots = q->size = 0;
+    return 0;
+}
+
+static int queue_slot(lua_State *L, queue *q)
+{
+    if (q->nfree > 0)
+        return q->free[--q->nfree];
+
+    if (q->nslots == q->size)
+    {
+        int size = q->size ? q->size * 2 : 64;
+        int *f = realloc(q->free, size * sizeof(int));
+        if (f == NULL)
+            luaL_error(L, "out of memory");
+        q->free = f;
+        q->size = size;
+    }
+    return q->nslots++;
+}
+
+static void queue_append(lua_State *L, queue_level *l, int slot)
+{
+    if (l->count == l->size)
+    {
+        unsigned int size = l->size ? l->size * 2 : 64;
+        unsigned int i;
+        int *ring = malloc(size * sizeof(int));
+        if (ring == NULL)
+            luaL_error(L, "out of memory");
+
+        /* unwrap the old ring at the start of the new one */
+        for (i = 0; i < l->count; i++)
+            ring[i] = l->ring[(l->head + i) & (l->size - 1)];
+        free(l->ring);
+        l->ring = ring;
+        l->head = 0;
+        l->size = size;
+    }
+    l->ring[(l->head + l->count) & (l->size - 1)] = slot;
+    l->count++;
+}
+
+/*
+** store the n values on top of the stack as a record of the given level,
+** the uservalue table of the queue must be just below them
+*/
+static void queue_post(lua_State *L, queue *q, int level, int n)
+{
+    int t = lua_gettop(L) - n;
+    int slot = queue_slot(L, q);
+    int k;
+
+    for (k = QUEUE_FIELDS; k > 0; k--)
+    {
+        if (k > n)
+            lua_pushnil(L);
+        lua_rawseti(L, t, slot * QUEUE_FIELDS + k);
+    }
+    queue_append(L, &q->level[level], slot);
+    q->posted++;
+}
+
+/* new_queue(): create an empty event queue */
+static int lc_new_queue(lua_State *L)
+{
+    queue *q = lua_newuserdata(L, sizeof(queue));
+    memset(q, 0, sizeof(queue));
+    luaL_getmetatable(L, QUEUEMETA);
+    lua_setmetatable(L, -2);
+    lua_newtable(L);
+    lua_setuservalue(L, -2);
+    return 1;
+}
+
+/*
+** queue:post(level, v1 [, v2, v3, v4])
+** add a record of up to four values at level 0 (urgent), 1 (normal) or
+** 2 (deferred). records come out by level, first in first out within one
+*/
+static int queue_post_lua(lua_State *L)
+{
+    queue *q = lc_checkqueue(L, 1);
+    int level = luaL_checkinteger(L, 2);
+    int n = lua_gettop(L) - 2;
+
+    luaL_argcheck(L, level >= 0 && level < QUEUE_LEVELS, 2, "bad level");
+    luaL_argcheck(L, n <= QUEUE_FIELDS, QUEUE_FIELDS + 3, "too many values");
+
+    lua_getuservalue(L, 1);
+    lua_insert(L, 3);
+    queue_post(L, q, level, n);
+    return 0;
+}
+
+/*
+** v1, v2, v3, v4 = queue:take()
+** remove the first record of the most urgent non-empty level. returns
+** nothing if the queue is empty
+*/
+static int queue_take(lua_State *L)
+{
+    queue *q = lc_checkqueue(L, 1);
+    queue_level *l = q->level;
+    int slot, k;
+
+    while (l->count == 0)
+        if (++l == q->level + QUEUE_LEVELS)
+            return 0;
+
+    slot = l->ring[l->head];
+    l->head = (l->head + 1) & (l->size - 1);
+    l->count--;
+    q->free[q->nfree++] = slot;
+    q->taken++;
+
+    lua_getuservalue(L, 1);
+    for (k = 1; k <= QUEUE_FIELDS; k++)
+    {
+        lua_rawgeti(L, 2, slot * QUEUE_FIELDS + k);
+        /* drop the reference so the value can be collected */
+        lua_pushnil(L);
+        lua_rawseti(L, 2, slot * QUEUE_FIELDS + k);
+    }
+    return QUEUE_FIELDS;
+}
+
+/*
+** queue:len([level])
+** number of records pending at level or any more urgent one, all records
+** if no level is given
+*/
+static int queue_len(lua_State *L)
+{
+    queue *q = lc_checkqueue(L, 1);
+    int level = luaL_optinteger(L, 2, QUEUE_LEVELS - 1);
+    unsigned int n = 0;
+    int i;
+
+    for (i = 0; i <= level && i < QUEUE_LEVELS; i++)
+        n += q->level[i].count;
+
+    lua_pushnumber(L, n);
+    return 1;
+}
+
+/*
+** queue:read_keys(window, type, level [, esc_delay_ms])
+** read every pending key of window into the queue as records of type,
+** code, name and meta. returns the number of keys read
+*/
+static int queue_read_keys(lua_State *L)
+{
+    queue *q = lc_checkqueue(L, 1);
+    WINDOW *w = lcw_check(L, 2);
+    int level = luaL_checkinteger(L, 4);
+    int delay = luaL_optinteger(L, 5, ESC_DELAY);
+    int code, meta, r;
+    int n = 0;
+
+    luaL_argcheck(L, level >= 0 && level < QUEUE_LEVELS, 4, "bad level");
+    lua_settop(L, 3);
+    lua_getuservalue(L, 1);
+
+    while ((r = lc_read_key(w, delay, &code, &meta)) >= 0)
+    {
+        if (r == 0)
+            continue;
+
+        lua_pushvalue(L, 3);
+        lua_pushnumber(L, code);
+        lc_push_key_name(L, code, meta);
+        lua_pushboolean(L, meta);
+        queue_post(L, q, level, 4);
+        n++;
+    }
+
+    lua_pushnumber(L, n);
+    return 1;
+}
+
+/* posted, taken, pending, slots = queue:stats() */
+static int queue_stats(lua_State *L)
+{
+    queue *q = lc_checkqueue(L, 1);
+    lua_pushnumber(L, q->posted);
+    lua_pushnumber(L, q->taken);
+    lua_pushnumber(L, q->posted - q->taken);
+    lua_pushnumber(L, q->nslots);
+    return 4;
+}
+
+/*
+** =======================================================
+** virtual list
+** =======================================================
+*/
+
+/*
+** items drawn in lines x columns slots, column after column, from the
+** top left corner of a window. the text of the items is asked for in
+** batches and only when it is not cached, and the list remembers what
+** it drew in every slot, so a redraw paints only the slots that changed.
+** scrolling by less than a column shifts the rows already drawn with
+** winsdelln and paints the ones that enter
+*/
+typedef struct
+{
+    int lines;
+    int columns;
+    int width;              /* cells of a slot, without the separator */
+    int text;               /* cells of item text */
+    attr_t attr;
+    attr_t sattr;           /* selected items */
+    wchar_t lmark, rmark;   /* around selected items, 0 for none */
+    chtype sep;             /* after every slot, 0 for none */
+    int slots;
+
+    /* text cache, item i is kept at slot (i - 1) % slots */
+    int *cached;            /* item held, 0 for none */
+    unsigned char *flag;    /* selected flag given by the fetch function */
+    int *ncells;
+    cchar_t *cells;         /* text cells of each slot */
+
+    /* what is on the window */
+    int top;
+    int *drawn;             /* item drawn in each slot, 0 blank, -1 unknown */
+    unsigned char *dsel;
+
+    unsigned long fetched;
+    unsigned long painted;
+} vlist;
+
+static vlist *lc_checkvlist(lua_State *L, int index)
+{
+    return (vlist*)luaL_checkudata(L, index, VLISTMETA);
+}
+
+static int vlist_gc(lua_State *L)
+{
+    vlist *v = lc_checkvlist(L, 1);
+    free(v->cached);
+    free(v->flag);
+    free(v->ncells);
+    free(v->cells);
+    free(v->drawn);
+    free(v->dsel);
+    memset(v, 0, sizeof(vlist));
+    return 0;
+}
+
+static void vlist_forget(vlist *v)
+{
+    int s;
+    for (s = 0; s < v->slots; s++)
+        v->drawn[s] = -1;
+}
+
+/*
+** curses.new_vlist(lines, columns, width, attr, selected_attr [, marks [, separator]])
+** marks is a string of two characters drawn around the selected items
+*/
+static int lc_new_vlist(lua_State *L)
+{
+    int lines = luaL_checkinteger(L, 1);
+    int columns = luaL_checkinteger(L, 2);
+    int width = luaL_checkinteger(L, 3);
+    attr_t attr = (attr_t)luaL_checknumber(L, 4);
+    attr_t sattr = (attr_t)luaL_checknumber(L, 5);
+    size_t len = 0;
+    const char *marks = luaL_optlstring(L, 6, "", &len);
+    chtype sep = (chtype)luaL_optnumber(L, 7, 0);
+    vlist *v;
+
+    luaL_argcheck(L, lines > 0, 1, "invalid number of lines");
+    luaL_argcheck(L, columns > 0, 2, "invalid number of columns");
+    luaL_argcheck(L, width >= 0, 3, "invalid width");
+
+    v = lua_newuserdata(L, sizeof(vlist));
+    memset(v, 0, sizeof(vlist));
+    luaL_getmetatable(L, VLISTMETA);
+    lua_setmetatable(L, -2);
+
+    if (len > 0)
+    {
+        const unsigned char *m = (const unsigned char*)marks;
+        size_t n = lc_utf8_next(m, m + len, &v->lmark);
+        if (n == 0 || lc_utf8_next(m + n, m + len, &v->rmark) == 0)
+            luaL_argerror(L, 6, "expected two characters");
+        /* no room for them */
+        if (width < 2)
+            v->lmark = v->rmark = 0;
+    }
+    v->lines = lines;
+    v->columns = columns;
+    v->width = width;
+    v->text = v->lmark ? width - 2 : width;
+    v->attr = attr;
+    v->sattr = sattr;
+    v->sep = sep;
+    v->slots = lines * columns;
+
+    v->cached = calloc(v->slots, sizeof(int));
+    v->flag = calloc(v->slots, 1);
+    v->ncells = calloc(v->slots, sizeof(int));
+    v->cells = calloc((size_t)v->slots * (v->text + 1), sizeof(cchar_t));
+    v->drawn = calloc(v->slots, sizeof(int));
+    v->dsel = calloc(v->slots, 1);
+    if (!v->cached || !v->flag || !v->ncells || !v->cells || !v->drawn || !v->dsel)
+        luaL_error(L, "not enough memory");
+    vlist_forget(v);
+
+    /* tables handed to the fetch function, window drawn on */
+    lua_createtable(L, 3, 0);
+    lua_newtable(L);
+    lua_rawseti(L, -2, 1);
+    lua_newtable(L);
+    lua_rawseti(L, -2, 2);
+    lua_setuservalue(L, -2);
+    return 1;
+}
+
+/*
+** call the fetch function (at index 6) for count items from first, and
+** cache their text. the tables it fills are at index 8 and 9
+*/
+static void vlist_fetch(lua_State *L, vlist *v, int first, int count)
+{
+    int i;
+
+    lua_pushvalue(L, 6);
+    lua_pushinteger(L, first);
+    lua_pushinteger(L, count);
+    lua_pushvalue(L, 8);
+    lua_pushvalue(L, 9);
+    lua_call(L, 4, 0);
+
+    for (i = 0; i < count; i++)
+    {
+        int slot = (first + i - 1) % v->slots;
+        cchar_t *cells = v->cells + (size_t)slot * (v->text + 1);
+        const char *str;
+        size_t len = 0;
+        int n, k, cols = 0;
+
+        lua_rawgeti(L, 8, i + 1);
+        str = lua_tolstring(L, -1, &len);
+        n = str ? lc_utf8_to_cchar(str, len, cells, v->text, A_NORMAL) : 0;
+        if (n < 0)
+            luaL_error(L, "invalid UTF-8 code");
+        lua_pop(L, 1);
+
+        /* cut at the text width and pad with blanks */
+        for (k = 0; k < n; k++)
+        {
+            int cw = wcwidth(cells[k].chars[0]);
+            if (cw < 1) cw = 1;
+            if (cols + cw > v->text)
+                break;
+            cols += cw;
+        }
+        for (n = k; cols < v->text; cols++)
+            cells[n++].chars[0] = ' ';
+        v->ncells[slot] = n;
+
+        lua_rawgeti(L, 9, i + 1);
+        v->flag[slot] = lua_toboolean(L, -1);
+        lua_pop(L, 1);
+        v->cached[slot] = first + i;
+
+        lua_pushnil(L);
+        lua_rawseti(L, 8, i + 1);
+        lua_pushnil(L);
+        lua_rawseti(L, 9, i + 1);
+    }
+    v->fetched += count;
+}
+
+/* paint slot s with item (0 for a blank slot) */
+static void vlist_paint(lua_State *L, vlist *v, WINDOW *w, int s, int item,
+    int sel)
+{
+    cchar_t *row = lc_scratch(L, v->width);
+    attr_t attr = sel ? v->sattr : v->attr;
+    int y = s % v->lines;
+    int x = (s / v->lines) * (v->width + (v->sep != 0));
+    int n = 0, i;
+
+    if (item == 0)
+    {
+        while (n < v->width)
+            row[n++].chars[0] = ' ';
+    }
+    else
+    {
+        int slot = (item - 1) % v->slots;
+        const cchar_t *cells = v->cells + (size_t)slot * (v->text + 1);
+
+        if (v->lmark)
+            row[n++].chars[0] = sel ? v->lmark : ' ';
+        for (i = 0; i < v->ncells[slot]; i++)
+            row[n++].chars[0] = cells[i].chars[0];
+        if (v->lmark)
+            row[n++].chars[0] = sel ? v->rmark : ' ';
+    }
+    for (i = 0; i < n; i++)
+        row[i].attr = attr;
+
+    mvwadd_wchnstr(w, y, x, row, n);
+    if (v->sep)
+        mvwaddch(w, y, x + v->width, v->sep | v->attr);
+}
+
+/* move the drawn rows by d lines, up if d is positive */
+static void vlist_shift(vlist *v, WINDOW *w, int d)
+{
+    int c, l;
+
+    if (d >= v->lines || -d >= v->lines || getmaxy(w) != v->lines
+        || getmaxx(w) > v->columns * (v->width + (v->sep != 0)))
+    {
+        vlist_forget(v);
+        return;
+    }
+
+    wmove(w, 0, 0);
+    winsdelln(w, -d);
+
+    for (c = 0; c < v->columns; c++)
+    {
+        int *drawn = v->drawn + c * v->lines;
+        unsigned char *dsel = v->dsel + c * v->lines;
+
+        if (d > 0)
+        {
+            memmove(drawn, drawn + d, (v->lines - d) * sizeof(int));
+            memmove(dsel, dsel + d, v->lines - d);
+            for (l = v->lines - d; l < v->lines; l++)
+                drawn[l] = -1;
+        }
+        else
+        {
+            memmove(drawn - d, drawn, (v->lines + d) * sizeof(int));
+            memmove(dsel - d, dsel, v->lines + d);
+            for (l = 0; l < -d; l++)
+                drawn[l] = -1;
+        }
+    }
+}
+
+/*
+** painted = vlist:draw(window, top, count, mark, fetch)
+** draw the items from top of a list of count items. an item is drawn
+** as selected if it is mark or fetch said so. fetch(first, n, texts,
+** flags) is called for the items that are not cached, and must set
+** texts[i] to the text of item first + i - 1, and flags[i] to true if
+** it is selected. returns the number of slots painted
+*/
+static int vlist_draw(lua_State *L)
+{
+    vlist *v = lc_checkvlist(L, 1);
+    WINDOW *w = lcw_check(L, 2);
+    int top = luaL_checkinteger(L, 3);
+    int count = luaL_checkinteger(L, 4);
+    int mark = luaL_optinteger(L, 5, 0);
+    int last, item, s;
+    int painted = 0;
+
+    luaL_argcheck(L, top > 0, 3, "invalid top item");
+    luaL_checktype(L, 6, LUA_TFUNCTION);
+    lua_settop(L, 6);
+    lua_getuservalue(L, 1);
+    lua_rawgeti(L, 7, 1);
+    lua_rawgeti(L, 7, 2);
+
+    /* what was drawn is known only if it is the same window */
+    lua_rawgeti(L, 7, 3);
+    if (!lua_rawequal(L, -1, 2))
+    {
+        vlist_forget(v);
+        lua_pushvalue(L, 2);
+        lua_rawseti(L, 7, 3);
+    }
+    else if (top != v->top)
+        vlist_shift(v, w, top - v->top);
+    lua_pop(L, 1);
+    v->top = top;
+
+    /* fetch runs of items that are not cached */
+    last = top + v->slots - 1 < count ? top + v->slots - 1 : count;
+    for (item = top; item <= last; )
+    {
+        int first = item;
+        while (item <= last && v->cached[(item - 1) % v->slots] != item)
+            item++;
+        if (item > first)
+            vlist_fetch(L, v, first, item - first);
+        else
+            item++;
+    }
+
+    for (s = 0; s < v->slots; s++)
+    {
+        int sel = 0;
+
+        item = top + s <= count ? top + s : 0;
+        if (item)
+            sel = v->flag[(item - 1) % v->slots] || item == mark;
+        if (v->drawn[s] == item && v->dsel[s] == sel)
+            continue;
+
+        vlist_paint(L, v, w, s, item, sel);
+        v->drawn[s] = item;
+        v->dsel[s] = sel;
+        painted++;
+    }
+    v->painted += painted;
+
+    lua_pushnumber(L, painted);
+    return 1;
+}
+
+/*
+** vlist:invalidate([item])
+** forget the text of item, or of every item and what was drawn
+*/
+static int vlist_invalidate(lua_State *L)
+{
+    vlist *v = lc_checkvlist(L, 1);
+
+    if (lua_isnoneornil(L, 2))
+    {
+        memset(v->cached, 0, v->slots * sizeof(int));
+        vlist_forget(v);
+    }
+    else
+    {
+        int item = luaL_checkinteger(L, 2);
+        if (item > 0)
+        {
+            int slot = (item - 1) % v->slots;
+            if (v->cached[slot] == item)
+                v->cached[slot] = 0;
+            if (item >= v->top && item - v->top < v->slots)
+                v->drawn[item - v->top] = -1;
+        }
+    }
+    return 0;
+}
+
+/* fetched, painted = vlist:stats() */
+static int vlist_stats(lua_State *L)
+{
+    vlist *v = lc_checkvlist(L, 1);
+    lua_pushnumber(L, v->fetched);
+    lua_pushnumber(L, v->painted);
+    return 2;
+}
+
+/*
+** =======================================================
+** beep
+** =======================================================
+*/
+LC_BOOLOK(beep)
+LC_BOOLOK(flash)
+
+
+/*
+** =======================================================
+** window
+** =======================================================
+*/
+
+static int lc_newwin(lua_State *L)
+{
+    int nlines  = luaL_checkinteger(L, 1);
+    int ncols   = luaL_checkinteger(L, 2);
+    int begin_y = luaL_checkinteger(L, 3);
+    int begin_x = luaL_checkinteger(L, 4);
+
+    lcw_new(L, newwin(nlines, ncols, begin_y, begin_x));
+    return 1;
+}
+
+/*
+** ok = window:close(), also the window __gc
+** delwin refuses a window that still has sub windows. the window is
+** then left open and false returned; a sub window keeps its parent
+** alive, so the collector never gets here with children left
+*/
+static int lcw_delwin(lua_State *L)
+{
+    lcwindow *w = (lcwindow*)lcw_get(L, 1);
+    if (w->w != NULL && w->w != stdscr)
+    {
+        if (w->children > 0 || delwin(w->w) == ERR)
+        {
+            lua_pushboolean(L, 0);
+            return 1;
+        }
+        w->w = NULL;
+        if (w->backing != NULL)
+            delwin(w->backing);
+        w->backing = NULL;
+        if (w->parent != NULL)
+            w->parent->children--;
+        w->parent = NULL;
+    }
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+/*
+** pads resized by window:resize_keep, and how many times the backing pad
+** had to be allocated
+*/
+static struct
+{
+    unsigned long resizes;
+    unsigned long reallocs;
+} resizes;
+
+/* capacity for n cells when cap are kept: at least half as much again */
+static int resize_capacity(int n, int cap)
+{
+    return n > cap ? (n > cap + cap / 2 ? n : cap + cap / 2) : cap;
+}
+
+/* blank the cells of w outside the lines x cols rectangle it had */
+static void resize_blank(WINDOW *w, int lines, int cols)
+{
+    int y, maxy = getmaxy(w);
+    int cy = getcury(w), cx = getcurx(w);
+
+    for (y = 0; y < maxy; y++)
+    {
+        if (y < lines && cols >= getmaxx(w))
+            continue;
+        wmove(w, y, y < lines ? cols : 0);
+        wclrtoeol(w);
+    }
+    wmove(w, cy < maxy ? cy : maxy - 1, cx < getmaxx(w) ? cx : getmaxx(w) - 1);
+}
+
+/*
+** move the pad w, with its modes and cells, into a subpad of a new
+** backing pad of lines x cols capacity. returns the subpad or NULL
+*/
+static WINDOW *resize_move(WINDOW *w, int lines, int cols, int caplines,
+                           int capcols, WINDOW **backing)
+{
+    int oldlines = getmaxy(w), oldcols = getmaxx(w);
+    int top, bottom;
+    WINDOW *pad = newpad(caplines, capcols);
+    WINDOW *nw;
+    cchar_t bkgd;
+    attr_t attr;
+    short pair;
+
+    if (pad == NULL)
+        return NULL;
+    nw = subpad(pad, lines, cols, 0, 0);
+    if (nw == NULL)
+    {
+        delwin(pad);
+        return NULL;
+    }
+
+    copywin(w, pad, 0, 0, 0, 0,
+        (oldlines < caplines ? oldlines : caplines) - 1,
+        (oldcols < capcols ? oldcols : capcols) - 1, FALSE);
+
+    if (wgetbkgrnd(w, &bkgd) != ERR)
+        wbkgrndset(nw, &bkgd);
+    if (wattr_get(w, &attr, &pair, NULL) != ERR)
+        wattr_set(nw, attr, pair, NULL);
+    leaveok(nw, is_leaveok(w));
+    scrollok(nw, is_scrollok(w));
+    keypad(nw, is_keypad(w));
+    notimeout(nw, is_notimeout(w));
+    idlok(nw, is_idlok(w));
+    idcok(nw, is_idcok(w));
+    immedok(nw, is_immedok(w));
+    syncok(nw, is_syncok(w));
+    wtimeout(nw, wgetdelay(w));
+    if (wgetscrreg(w, &top, &bottom) != ERR && bottom < lines)
+        wsetscrreg(nw, top, bottom);
+    wmove(nw, getcury(w) < lines ? getcury(w) : lines - 1,
+        getcurx(w) < cols ? getcurx(w) : cols - 1);
+
+    *backing = pad;
+    return nw;
+}
+
+/*
+** ok = window:resize_keep(lines, cols)
+** resize a pad, keeping its cells. the cells live in a backing pad that
+** grows by half as much again when it is too small, so that resizing
+** within its capacity allocates nothing. other windows are resized
+** with wresize
+*/
+static int lcw_resize_keep(lua_State *L)
+{
+    lcwindow *w = (lcwindow*)lcw_get(L, 1);
+    int lines = luaL_checkinteger(L, 2);
+    int cols = luaL_checkinteger(L, 3);
+    int oldlines, oldcols;
+    WINDOW *nw, *backing;
+
+    luaL_argcheck(L, lines > 0, 2, "invalid number of lines");
+    luaL_argcheck(L, cols > 0, 3, "invalid number of columns");
+    lcw_check(L, 1);
+    oldlines = getmaxy(w->w);
+    oldcols = getmaxx(w->w);
+    resizes.resizes++;
+
+    if (lines == oldlines && cols == oldcols)
+    {
+        lua_pushboolean(L, 1);
+        return 1;
+    }
+
+    /*
+    ** sub windows point into the cells, which must stay where they are,
+    ** and delwin would refuse to free the old pad while they exist
+    */
+    if (!is_pad(w->w) || w->children > 0)
+    {
+        lua_pushboolean(L, B(wresize(w->w, lines, cols)));
+        return 1;
+    }
 
-    lcw_new(L, newwin(nlines, ncols, begin_y, begin_x));
-    return 1;
-}
+    /* it fits the backing pad: the subpad only changes size */
+    if (w->backing != NULL && lines <= getmaxy(w->backing) &&
+        cols <= getmaxx(w->backing) && wresize(w->w, lines, cols) != ERR)
+    {
+        resize_blank(w->w, oldlines, oldcols);
+        lua_pushboolean(L, 1);
+        return 1;
+    }
 
-static int lcw_delwin(lua_State *L)
-{
-    WINDOW **w = lcw_get(L, 1);
-    if (*w != NULL && *w != stdscr)
+    nw = resize_move(w->w, lines, cols,
+        resize_capacity(lines, w->backing ? getmaxy(w->backing) : oldlines),
+        resize_capacity(cols, w->backing ? getmaxx(w->backing) : oldcols),
+        &backing);
+    if (nw == NULL)
     {
-        delwin(*w);
-        *w = NULL;
+        lua_pushboolean(L, B(wresize(w->w, lines, cols)));
+        return 1;
     }
-    return 0;
+    delwin(w->w);
+    if (w->backing != NULL)
+        delwin(w->backing);
+    w->w = nw;
+    w->backing = backing;
+    resizes.reallocs++;
+
+    resize_blank(nw, oldlines, oldcols);
+    lua_pushboolean(L, 1);
+    return 1;
 }
 
-static int lcw_mvwin(lua_State *L)
+/*
+** resizes, reallocs = curses.resize_stats()
+** calls to window:resize_keep and how many allocated a backing pad
+*/
+static int lc_resize_stats(lua_State *L)
 {
-    WINDOW *w = lcw_check(L, 1);
-    int y = luaL_checkinteger(L, 2);
-    int x = luaL_checkinteger(L, 3);
-    lua_pushboolean(L, B(mvwin(w, y, x)));
-    return 1;
+    lua_pushnumber(L, resizes.resizes);
+    lua_pushnumber(L, resizes.reallocs);
+    return 2;
 }
 
+LCW_BOOLOK_INT2(mvwin)
+
 static int lcw_subwin(lua_State *L)
 {
     WINDOW *orig = lcw_check(L, 1);
@@ -732,7 +3227,7 @@ static int lcw_subwin(lua_State *L)
     int begin_y = luaL_checkinteger(L, 4);
     int begin_x = luaL_checkinteger(L, 5);
 
-    lcw_new(L, subwin(orig, nlines, ncols, begin_y, begin_x));
+    lcw_new_sub(L, subwin(orig, nlines, ncols, begin_y, begin_x), 1);
     return 1;
 }
 
@@ -744,18 +3239,11 @@ static int lcw_derwin(lua_State *L)
     int begin_y = luaL_checkinteger(L, 4);
     int begin_x = luaL_checkinteger(L, 5);
 
-    lcw_new(L, derwin(orig, nlines, ncols, begin_y, begin_x));
+    lcw_new_sub(L, derwin(orig, nlines, ncols, begin_y, begin_x), 1);
     return 1;
 }
 
-static int lcw_mvderwin(lua_State *L)
-{
-    WINDOW *w = lcw_check(L, 1);
-    int par_y = luaL_checkinteger(L, 2);
-    int par_x = luaL_checkinteger(L, 3);
-    lua_pushboolean(L, B(mvderwin(w, par_y, par_x)));
-    return 1;
-}
+LCW_BOOLOK_INT2(mvderwin)
 
 static int lcw_dupwin(lua_State *L)
 {
@@ -764,69 +3252,62 @@ static int lcw_dupwin(lua_State *L)
     return 1;
 }
 
-static int lcw_wsyncup(lua_State *L)
-{
-    WINDOW *w = lcw_check(L, 1);
-    wsyncup(w);
-    return 0;
-}
+LCW_VOID(wsyncup)
+LCW_BOOLOK_BOOL(syncok)
+LCW_VOID(wcursyncup)
+LCW_VOID(wsyncdown)
 
-static int lcw_syncok(lua_State *L)
+/*
+** =======================================================
+** refresh
+** =======================================================
+*/
+static int lcw_wrefresh(lua_State *L)
 {
     WINDOW *w = lcw_check(L, 1);
-    int bf = lua_toboolean(L, 2);
-    lua_pushboolean(L, B(syncok(w, bf)));
-    return 1;
-}
+    int r;
 
-static int lcw_wcursyncup(lua_State *L)
-{
-    WINDOW *w = lcw_check(L, 1);
-    wcursyncup(w);
-    return 0;
+    output_begin();
+    r = wrefresh(w);
+    output_end();
+    lua_pushboolean(L, B(r));
+    return 1;
 }
 
-static int lcw_wsyncdown(lua_State *L)
-{
-    WINDOW *w = lcw_check(L, 1);
-    wsyncdown(w);
-    return 0;
-}
+LCW_BOOLOK(wnoutrefresh)
+LCW_BOOLOK(redrawwin)
+LCW_BOOLOK_INT2(wredrawln)
 
 /*
-** =======================================================
-** refresh
-** =======================================================
+** frame and copy counters reported by curses.damage_stats
 */
-LCW_BOOLOK(wrefresh)
-LCW_BOOLOK(wnoutrefresh)
-LCW_BOOLOK(redrawwin)
+static struct
+{
+    unsigned long frames;   /* doupdate calls */
+    unsigned long rows;     /* rows copied by window:copy_damaged */
+    unsigned long cells;    /* cells copied by window:copy_damaged */
+    unsigned long composed; /* cells copied by window:compose */
+} damage;
 
-static int lcw_wredrawln(lua_State *L)
+static int lc_doupdate(lua_State *L)
 {
-    WINDOW *w = lcw_check(L, 1);
-    int beg_line = luaL_checkinteger(L, 2);
-    int num_lines = luaL_checkinteger(L, 3);
-    lua_pushboolean(L, B(wredrawln(w, beg_line, num_lines)));
+    int r;
+
+    damage.frames++;
+    output_begin();
+    r = doupdate();
+    output_end();
+    lua_pushboolean(L, B(r));
     return 1;
 }
 
-LC_BOOLOK(doupdate)
-
 /*
 ** =======================================================
 ** move
 ** =======================================================
 */
 
-static int lcw_wmove(lua_State *L)
-{
-    WINDOW *w = lcw_check(L, 1);
-    int y = luaL_checkinteger(L, 2);
-    int x = luaL_checkinteger(L, 3);
-    lua_pushboolean(L, B(wmove(w, y, x)));
-    return 1;
-}
+LCW_BOOLOK_INT2(wmove)
 
 /*
 ** =======================================================
@@ -834,13 +3315,7 @@ static int lcw_wmove(lua_State *L)
 ** =======================================================
 */
 
-static int lcw_wscrl(lua_State *L)
-{
-    WINDOW *w = lcw_check(L, 1);
-    int n = luaL_checkinteger(L, 2);
-    lua_pushboolean(L, B(wscrl(w, n)));
-    return 1;
-}
+LCW_BOOLOK_INT(wscrl)
 
 /*
 ** =======================================================
@@ -899,45 +3374,10 @@ static int lcw_is_wintouched(lua_State *L)
 ** =======================================================
 */
 
-static int lcw_getyx(lua_State *L)
-{
-    WINDOW *w = lcw_check(L, 1);
-    int y, x;
-    getyx(w, y, x);
-    lua_pushnumber(L, y);
-    lua_pushnumber(L, x);
-    return 2;
-}
-
-static int lcw_getparyx(lua_State *L)
-{
-    WINDOW *w = lcw_check(L, 1);
-    int y, x;
-    getparyx(w, y, x);
-    lua_pushnumber(L, y);
-    lua_pushnumber(L, x);
-    return 2;
-}
-
-static int lcw_getbegyx(lua_State *L)
-{
-    WINDOW *w = lcw_check(L, 1);
-    int y, x;
-    getbegyx(w, y, x);
-    lua_pushnumber(L, y);
-    lua_pushnumber(L, x);
-    return 2;
-}
-
-static int lcw_getmaxyx(lua_State *L)
-{
-    WINDOW *w = lcw_check(L, 1);
-    int y, x;
-    getmaxyx(w, y, x);
-    lua_pushnumber(L, y);
-    lua_pushnumber(L, x);
-    return 2;
-}
+LCW_YX(getyx)
+LCW_YX(getparyx)
+LCW_YX(getbegyx)
+LCW_YX(getmaxyx)
 
 /*
 ** =======================================================
@@ -1017,6 +3457,56 @@ static int lcw_mvwvline(lua_State *L)
     return 1;
 }
 
+/*
+** w:draw_scrollbar(vertical, length, pos, limit, attr [, thumb_attr])
+** draws a scroll bar of length cells from the window origin: an arrow at
+** each end and the track between them, with the thumb at the cell for pos
+** when limit > 1. returns the offset of the thumb, or nil without one
+*/
+static int lcw_draw_scrollbar(lua_State *L)
+{
+    WINDOW *w = lcw_check(L, 1);
+    int vertical = lua_toboolean(L, 2);
+    int length = luaL_checkinteger(L, 3);
+    lua_Integer pos = luaL_checkinteger(L, 4);
+    lua_Integer limit = luaL_checkinteger(L, 5);
+    chtype attr = luaL_checkinteger(L, 6);
+    chtype thumb_attr = luaL_optinteger(L, 7, attr);
+    int track = length - 2;
+    int thumb = 0;
+
+    if (length <= 0)
+        return 0;
+
+    if (limit > 1 && track > 0) {
+        if (pos < 1) pos = 1;
+        else if (pos > limit) pos = limit;
+        /* same rounding as tscrollbar:set_position */
+        thumb = pos == 1 ? 1 : (int)((pos * track + limit - 1) / limit);
+    }
+
+    if (vertical) {
+        mvwaddch(w, 0, 0, ACS_UARROW | attr);
+        if (track > 0)
+            mvwvline(w, 1, 0, ' ' | attr, track);
+        if (thumb)
+            mvwaddch(w, thumb, 0, '#' | thumb_attr);
+        mvwaddch(w, length - 1, 0, ACS_DARROW | attr);
+    } else {
+        mvwaddch(w, 0, 0, ACS_LARROW | attr);
+        if (track > 0)
+            mvwhline(w, 0, 1, ' ' | attr, track);
+        if (thumb)
+            mvwaddch(w, 0, thumb, '#' | thumb_attr);
+        mvwaddch(w, 0, length - 1, ACS_RARROW | attr);
+    }
+
+    if (!thumb)
+        return 0;
+    lua_pushinteger(L, thumb);
+    return 1;
+}
+
 /*
 ** =======================================================
 ** clear
@@ -1091,13 +3581,7 @@ static int lc_slk_attrset(lua_State *L)
 ** =======================================================
 */
 
-static int lcw_waddch(lua_State *L)
-{
-    WINDOW *w = lcw_check(L, 1);
-    chtype ch = lc_checkchtype(L, 2);
-    lua_pushboolean(L, B(waddch(w, ch)));
-    return 1;
-}
+LCW_BOOLOK_CHTYPE(waddch)
 
 static int lcw_mvwaddch(lua_State *L)
 {
@@ -1111,12 +3595,17 @@ static int lcw_mvwaddch(lua_State *L)
     return 1;
 }
 
+/* echochar refreshes the window, so its output is a frame */
 static int lcw_wechochar(lua_State *L)
 {
     WINDOW *w = lcw_check(L, 1);
     chtype ch = lc_checkchtype(L, 2);
+    int r;
 
-    lua_pushboolean(L, B(wechochar(w, ch)));
+    output_begin();
+    r = wechochar(w, ch);
+    output_end();
+    lua_pushboolean(L, B(r));
     return 1;
 }
 
@@ -1160,43 +3649,26 @@ static int lcw_mvwaddchnstr(lua_State *L)
 ** =======================================================
 */
 
-static int lcw_waddnstr(lua_State *L)
+/* draw utf-8 text as cells at the cursor position */
+static int lc_waddustr(lua_State *L, WINDOW *w, const char *s, size_t len)
 {
-  WINDOW *w = lcw_check(L, 1);
-
-  lua_Integer max_len = luaL_len(L, 2);
+  /* a utf-8 string never decodes to more cells than it has bytes */
+  cchar_t * str = lc_scratch(L, len);
 
-  cchar_t * str = malloc(sizeof(*str) * max_len);
-  memset(str, 0, sizeof(*str) * max_len);
+  int i = lc_utf8_to_cchar(s, len, str, (int)len, A_NORMAL);
+  if (i < 0)
+    return luaL_error(L, "invalid UTF-8 code");
 
-  int i = 0;
-  int n = lua_gettop(L);
-  lua_getglobal(L, "utf8");
-  lua_getfield(L, -1, "codes");
-  lua_remove(L, -2); // remove global utf8
-  lua_pushvalue(L, 2);
-
-  lua_call(L, 1, LUA_MULTRET);
-  while (1) {
-    lua_pushvalue(L, -3);
-    lua_insert(L, -3);
-    lua_pushvalue(L, -2);
-    lua_insert(L, -4);
-
-    lua_call(L, 2, LUA_MULTRET);
-    if (lua_gettop(L) == n + 2) {
-      lua_pop(L, 2);
-      break;
-    } else {
-      str[i].chars[0] = lua_tointeger(L, -1);
-      str[i++].attr = A_NORMAL;
+  return wadd_wchnstr(w, str, i);
+}
 
-      lua_pop(L, 1);
-    }
-  }
+static int lcw_waddnstr(lua_State *L)
+{
+  WINDOW *w = lcw_check(L, 1);
+  size_t len;
+  const char *s = luaL_checklstring(L, 2, &len);
 
-  lua_pushboolean(L, B(wadd_wchnstr(w, str, i)));
-  free(str);
+  lua_pushboolean(L, B(lc_waddustr(L, w, s, len)));
   return 1;
 }
 
@@ -1229,13 +3701,7 @@ static int lcw_wbkgdset(lua_State *L)
     return 0;
 }
 
-static int lcw_wbkgd(lua_State *L)
-{
-    WINDOW *w = lcw_check(L, 1);
-    chtype ch = lc_checkchtype(L, 2);
-    lua_pushboolean(L, B(wbkgd(w, ch)));
-    return 1;
-}
+LCW_BOOLOK_CHTYPE(wbkgd)
 
 static int lcw_getbkgd(lua_State *L)
 {
@@ -1284,13 +3750,7 @@ static int lc_halfdelay(lua_State *L)
     return 1;
 }
 
-static int lcw_intrflush(lua_State *L)
-{
-    WINDOW *w = lcw_check(L, 1);
-    int bf = lua_toboolean(L, 2);
-    lua_pushboolean(L, B(intrflush(w, bf)));
-    return 1;
-}
+LCW_BOOLOK_BOOL(intrflush)
 
 static int lcw_keypad(lua_State *L)
 {
@@ -1300,21 +3760,8 @@ static int lcw_keypad(lua_State *L)
     return 1;
 }
 
-static int lcw_meta(lua_State *L)
-{
-    WINDOW *w = lcw_check(L, 1);
-    int bf = lua_toboolean(L, 2);
-    lua_pushboolean(L, B(meta(w, bf)));
-    return 1;
-}
-
-static int lcw_nodelay(lua_State *L)
-{
-    WINDOW *w = lcw_check(L, 1);
-    int bf = lua_toboolean(L, 2);
-    lua_pushboolean(L, B(nodelay(w, bf)));
-    return 1;
-}
+LCW_BOOLOK_BOOL(meta)
+LCW_BOOLOK_BOOL(nodelay)
 
 static int lcw_timeout(lua_State *L)
 {
@@ -1324,13 +3771,7 @@ static int lcw_timeout(lua_State *L)
     return 0;
 }
 
-static int lcw_notimeout(lua_State *L)
-{
-    WINDOW *w = lcw_check(L, 1);
-    int bf = lua_toboolean(L, 2);
-    lua_pushboolean(L, B(notimeout(w, bf)));
-    return 1;
-}
+LCW_BOOLOK_BOOL(notimeout)
 
 /*
 ** =======================================================
@@ -1347,105 +3788,325 @@ static int lc_nl(lua_State *L)
     return 1;
 }
 
-static int lcw_clearok(lua_State *L)
+LCW_BOOLOK_BOOL(clearok)
+LCW_BOOLOK_BOOL(idlok)
+LCW_BOOLOK_BOOL(leaveok)
+LCW_BOOLOK_BOOL(scrollok)
+LCW_VOID_BOOL(idcok)
+LCW_VOID_BOOL(immedok)
+LCW_BOOLOK_INT2(wsetscrreg)
+
+/*
+** =======================================================
+** overlay
+** =======================================================
+*/
+
+LCW_BOOLOK_WIN(overlay)
+LCW_BOOLOK_WIN(overwrite)
+
+static int lcw_copywin(lua_State *L)
 {
-    WINDOW *w = lcw_check(L, 1);
-    bool bf = lua_toboolean(L, 2);
-    lua_pushboolean(L, B(clearok(w, bf)));
+    WINDOW *srcwin = lcw_check(L, 1);
+    WINDOW *dstwin = lcw_check(L, 2);
+    int sminrow = luaL_checkinteger(L, 3);
+    int smincol = luaL_checkinteger(L, 4);
+    int dminrow = luaL_checkinteger(L, 5);
+    int dmincol = luaL_checkinteger(L, 6);
+    int dmaxrow = luaL_checkinteger(L, 7);
+    int dmaxcol = luaL_checkinteger(L, 8);
+    int overlay = lua_toboolean(L, 9);
+
+    lua_pushboolean(L, B(copywin(srcwin, dstwin, sminrow,
+        smincol, dminrow, dmincol, dmaxrow, dmaxcol, overlay)));
+
     return 1;
 }
 
-static int lcw_idlok(lua_State *L)
+/*
+** copy only the rows of the source window that were touched since the
+** last copy, then untouch them. the source is never refreshed, so its
+** touched lines are exactly the rows drawn on since then. takes the
+** same arguments as window:copy (without the overlay flag) and
+** returns the number of rows copied
+*/
+static int lcw_copy_damaged(lua_State *L)
 {
-    WINDOW *w = lcw_check(L, 1);
-    bool bf = lua_toboolean(L, 2);
-    lua_pushboolean(L, B(idlok(w, bf)));
+    WINDOW *srcwin = lcw_check(L, 1);
+    WINDOW *dstwin = lcw_check(L, 2);
+    int sminrow = luaL_checkinteger(L, 3);
+    int smincol = luaL_checkinteger(L, 4);
+    int dminrow = luaL_checkinteger(L, 5);
+    int dmincol = luaL_checkinteger(L, 6);
+    int dmaxrow = luaL_checkinteger(L, 7);
+    int dmaxcol = luaL_checkinteger(L, 8);
+    int srows = getmaxy(srcwin);
+    int nrows = dmaxrow - dminrow + 1;
+    int copied = 0;
+    int r = 0;
+
+    luaL_argcheck(L, sminrow >= 0, 3, "row out of range");
+    if (sminrow + nrows > srows)
+        nrows = srows - sminrow;
+
+    /* copy runs of touched rows with one copywin each */
+    while (r < nrows)
+    {
+        int first;
+        if (is_linetouched(srcwin, sminrow + r) != TRUE)
+        {
+            r++;
+            continue;
+        }
+
+        first = r;
+        while (r < nrows && is_linetouched(srcwin, sminrow + r) == TRUE)
+            r++;
+
+        if (copywin(srcwin, dstwin, sminrow + first, smincol,
+            dminrow + first, dmincol, dminrow + r - 1, dmaxcol, 0) == ERR)
+            break;
+        wtouchln(srcwin, sminrow + first, r - first, 0);
+        copied += r - first;
+    }
+
+    damage.rows += copied;
+    damage.cells += (unsigned long)copied * (dmaxcol - dmincol + 1);
+
+    lua_pushnumber(L, copied);
     return 1;
 }
 
-static int lcw_leaveok(lua_State *L)
+/*
+** compositing of child windows. a group passes its visible children
+** bottom to top in a flat table, five values each: window, y, x, lines
+** and columns, the position relative to the group. the rows of the
+** group window that need repainting are kept as one span of columns per
+** row, and every child is copied only where it covers those spans
+*/
+#define COMPOSE_FIELDS  5
+
+typedef struct
 {
-    WINDOW *w = lcw_check(L, 1);
-    bool bf = lua_toboolean(L, 2);
-    lua_pushboolean(L, B(leaveok(w, bf)));
-    return 1;
-}
+    WINDOW *w;
+    int y, x;               /* position in the destination */
+    int lines, cols;
+} compose_child;
 
-static int lcw_scrollok(lua_State *L)
+typedef struct
 {
-    WINDOW *w = lcw_check(L, 1);
-    bool bf = lua_toboolean(L, 2);
-    lua_pushboolean(L, B(scrollok(w, bf)));
-    return 1;
-}
+    int *lo;                /* first damaged column of each row */
+    int *hi;                /* one past the last one */
+} compose_spans;
 
-static int lcw_idcok(lua_State *L)
+/* clear spans for rows rows, in the scratch bytes of the state */
+static void compose_spans_init(lua_State *L, compose_spans *s, int rows,
+    int cols)
 {
-    WINDOW *w = lcw_check(L, 1);
-    bool bf = lua_toboolean(L, 2);
-    idcok(w, bf);
-    return 0;
+    int r;
+
+    s->lo = (int*)lc_scratch_bytes(L, 2 * (size_t)rows * sizeof(int));
+    s->hi = s->lo + rows;
+    for (r = 0; r < rows; r++)
+    {
+        s->lo[r] = cols;
+        s->hi[r] = 0;
+    }
 }
 
-static int lcw_immedok(lua_State *L)
+/* integer k of the children table at index t */
+static int compose_int(lua_State *L, int t, int k)
 {
-    WINDOW *w = lcw_check(L, 1);
-    bool bf = lua_toboolean(L, 2);
-    immedok(w, bf);
-    return 0;
+    int isnum;
+    lua_Integer v;
+
+    lua_rawgeti(L, t, k);
+    v = lua_tointegerx(L, -1, &isnum);
+    if (!isnum)
+        luaL_error(L, "bad children entry %d (integer expected, got %s)",
+            k, luaL_typename(L, -1));
+    lua_pop(L, 1);
+    return (int)v;
 }
 
-static int lcw_wsetscrreg(lua_State *L)
+/* read child i (from 1) of the table at index t, scrolled by sy, sx */
+static void compose_get(lua_State *L, int t, int i, int sy, int sx,
+    compose_child *c)
+{
+    int base = (i - 1) * COMPOSE_FIELDS;
+    WINDOW **w;
+
+    lua_rawgeti(L, t, base + 1);
+    w = (WINDOW**)luaL_testudata(L, -1, WINDOWMETA);
+    if (w == NULL || *w == NULL)
+        luaL_error(L, "bad children entry %d (%s)", base + 1,
+            w == NULL ? "curses window expected" : "closed curses window");
+    c->w = *w;
+    lua_pop(L, 1);
+    c->y = compose_int(L, t, base + 2) - sy;
+    c->x = compose_int(L, t, base + 3) - sx;
+    c->lines = compose_int(L, t, base + 4);
+    c->cols = compose_int(L, t, base + 5);
+}
+
+/* mark the columns [x0, x1) of rows [y0, y1) of the destination */
+static void compose_damage(compose_spans *s, int y0, int x0, int y1, int x1,
+    int rows, int cols)
 {
-    WINDOW *w = lcw_check(L, 1);
-    int top = luaL_checkinteger(L, 2);
-    int bot = luaL_checkinteger(L, 3);
-    lua_pushboolean(L, B(wsetscrreg(w, top, bot)));
-    return 1;
+    int r;
+
+    if (y0 < 0) y0 = 0;
+    if (x0 < 0) x0 = 0;
+    if (y1 > rows) y1 = rows;
+    if (x1 > cols) x1 = cols;
+
+    for (r = y0; r < y1 && x0 < x1; r++)
+    {
+        if (s->lo[r] > x0) s->lo[r] = x0;
+        if (s->hi[r] < x1) s->hi[r] = x1;
+    }
 }
 
 /*
-** =======================================================
-** overlay
-** =======================================================
+** copy child c where it covers the damaged spans, one copywin per run of
+** rows with the same span. rows that were copied whole are marked as
+** untouched in the child when clear is set. returns the cells copied
 */
-
-static int lcw_overlay(lua_State *L)
+static unsigned long compose_copy(WINDOW *dst, compose_spans *s,
+    compose_child *c, int rows, int cols, int clear)
 {
-    WINDOW *srcwin = lcw_check(L, 1);
-    WINDOW *dstwin = lcw_check(L, 2);
+    int y0 = c->y < 0 ? 0 : c->y;
+    int y1 = c->y + c->lines > rows ? rows : c->y + c->lines;
+    unsigned long cells = 0;
+    int r = y0;
 
-    lua_pushboolean(L, B(overlay(srcwin, dstwin)));
-    return 1;
+    while (r < y1)
+    {
+        int lo = s->lo[r] > c->x ? s->lo[r] : c->x;
+        int hi = s->hi[r] < c->x + c->cols ? s->hi[r] : c->x + c->cols;
+        int first = r;
+
+        if (lo >= hi)
+        {
+            r++;
+            continue;
+        }
+        while (++r < y1 && s->lo[r] == s->lo[first]
+            && s->hi[r] == s->hi[first])
+            ;
+
+        if (copywin(c->w, dst, first - c->y, lo - c->x, first, lo,
+            r - 1, hi - 1, 0) == ERR)
+            continue;
+        cells += (unsigned long)(r - first) * (hi - lo);
+
+        if (clear && lo == (c->x > 0 ? c->x : 0)
+            && hi == (c->x + c->cols < cols ? c->x + c->cols : cols))
+            wtouchln(c->w, first - c->y, r - first, 0);
+    }
+    return cells;
 }
 
-static int lcw_overwrite(lua_State *L)
+/*
+** cells = window:compose(children, n, scroll_y, scroll_x [, index])
+** copy the n children on the window, scrolled by scroll_y, scroll_x.
+** with index, only the rows that child touched since it was last
+** composed are repainted, together with the parts of the children
+** above it that cover them; otherwise every child is copied whole
+*/
+static int lcw_compose(lua_State *L)
 {
-    WINDOW *srcwin = lcw_check(L, 1);
-    WINDOW *dstwin = lcw_check(L, 2);
+    WINDOW *dst = lcw_check(L, 1);
+    int n = luaL_checkinteger(L, 3);
+    int sy = luaL_checkinteger(L, 4);
+    int sx = luaL_checkinteger(L, 5);
+    int index = luaL_optinteger(L, 6, 0);
+    int all = index == 0;
+    unsigned long cells = 0;
+    compose_spans s;
+    compose_child c;
+    int rows, cols, i;
+
+    luaL_checktype(L, 2, LUA_TTABLE);
+    luaL_argcheck(L, index >= 0 && index <= n, 6, "bad child index");
+    getmaxyx(dst, rows, cols);
+    compose_spans_init(L, &s, rows, cols);
+
+    if (all)
+    {
+        compose_damage(&s, 0, 0, rows, cols, rows, cols);
+        index = 1;
+    }
+    else
+    {
+        int r;
+
+        compose_get(L, 2, index, sy, sx, &c);
+        for (r = 0; r < c.lines; r++)
+            if (is_linetouched(c.w, r) == TRUE)
+                compose_damage(&s, c.y + r, c.x, c.y + r + 1, c.x + c.cols,
+                    rows, cols);
+    }
 
-    lua_pushboolean(L, B(overwrite(srcwin, dstwin)));
+    for (i = index; i <= n; i++)
+    {
+        compose_get(L, 2, i, sy, sx, &c);
+        cells += compose_copy(dst, &s, &c, rows, cols, all || i == index);
+    }
+
+    damage.composed += cells;
+    lua_pushnumber(L, cells);
     return 1;
 }
 
-static int lcw_copywin(lua_State *L)
+/*
+** cells = window:compose_rect(children, n, scroll_y, scroll_x, y, x, lines, cols)
+** repaint the rectangle at y, x (in children coordinates) from every
+** child that covers it, as after a child was moved, shown or hidden
+*/
+static int lcw_compose_rect(lua_State *L)
 {
-    WINDOW *srcwin = lcw_check(L, 1);
-    WINDOW *dstwin = lcw_check(L, 2);
-    int sminrow = luaL_checkinteger(L, 3);
-    int smincol = luaL_checkinteger(L, 4);
-    int dminrow = luaL_checkinteger(L, 5);
-    int dmincol = luaL_checkinteger(L, 6);
-    int dmaxrow = luaL_checkinteger(L, 7);
-    int dmaxcol = luaL_checkinteger(L, 8);
-    int overlay = lua_toboolean(L, 9);
-
-    lua_pushboolean(L, B(copywin(srcwin, dstwin, sminrow,
-        smincol, dminrow, dmincol, dmaxrow, dmaxcol, overlay)));
+    WINDOW *dst = lcw_check(L, 1);
+    int n = luaL_checkinteger(L, 3);
+    int sy = luaL_checkinteger(L, 4);
+    int sx = luaL_checkinteger(L, 5);
+    int y = luaL_checkinteger(L, 6) - sy;
+    int x = luaL_checkinteger(L, 7) - sx;
+    int lines = luaL_checkinteger(L, 8);
+    int ncols = luaL_checkinteger(L, 9);
+    unsigned long cells = 0;
+    compose_spans s;
+    compose_child c;
+    int rows, cols, i;
+
+    luaL_checktype(L, 2, LUA_TTABLE);
+    getmaxyx(dst, rows, cols);
+    compose_spans_init(L, &s, rows, cols);
+    compose_damage(&s, y, x, y + lines, x + ncols, rows, cols);
+
+    for (i = 1; i <= n; i++)
+    {
+        compose_get(L, 2, i, sy, sx, &c);
+        cells += compose_copy(dst, &s, &c, rows, cols, 0);
+    }
 
+    damage.composed += cells;
+    lua_pushnumber(L, cells);
     return 1;
 }
 
+/* frames, rows and cells copied, cells composed; reset if asked to */
+static int lc_damage_stats(lua_State *L)
+{
+    lua_pushnumber(L, damage.frames);
+    lua_pushnumber(L, damage.rows);
+    lua_pushnumber(L, damage.cells);
+    lua_pushnumber(L, damage.composed);
+    if (lua_toboolean(L, 1))
+        memset(&damage, 0, sizeof(damage));
+    return 4;
+}
+
 /*
 ** =======================================================
 ** util
@@ -1486,16 +4147,7 @@ static int lc_flushinp(lua_State *L)
 */
 
 LCW_BOOLOK(wdelch)
-
-static int lcw_mvwdelch(lua_State *L)
-{
-    WINDOW *w = lcw_check(L, 1);
-    int y = luaL_checkinteger(L, 2);
-    int x = luaL_checkinteger(L, 3);
-
-    lua_pushboolean(L, B(mvwdelch(w, y, x)));
-    return 1;
-}
+LCW_BOOLOK_INT2(mvwdelch)
 
 /*
 ** =======================================================
@@ -1505,14 +4157,7 @@ static int lcw_mvwdelch(lua_State *L)
 
 LCW_BOOLOK(wdeleteln)
 LCW_BOOLOK(winsertln)
-
-static int lcw_winsdelln(lua_State *L)
-{
-    WINDOW *w = lcw_check(L, 1);
-    int n = luaL_checkinteger(L, 2);
-    lua_pushboolean(L, B(winsdelln(w, n)));
-    return 1;
-}
+LCW_BOOLOK_INT(winsdelln)
 
 /*
 ** =======================================================
@@ -1620,18 +4265,36 @@ static int lcw_mvwinch(lua_State *L)
 ** =======================================================
 */
 
-static int lcw_winchnstr(lua_State *L)
+/*
+** read up to n cells from the cursor into a new chstr. the line may end
+** before n cells, and win_wchnstr stores a terminating cell after the
+** ones read, so the chstr gets one spare cell and the length read
+*/
+static int lc_winchnstr(lua_State *L, WINDOW *w, int n)
 {
-    WINDOW *w = lcw_check(L, 1);
-    int n = luaL_checkinteger(L, 2);
-    chstr *cs = chstr_new(L, n);
+    chstr *cs;
+    unsigned int i;
 
-    if (wadd_wchnstr(w, cs->str, n) == ERR)
+    luaL_argcheck(L, n > 0, lua_gettop(L), "invalid length");
+    cs = chstr_new(L, n + 1);
+    if (win_wchnstr(w, cs->str, n) == ERR)
         return 0;
 
+    for (i = 0; i < (unsigned int)n && cs->str[i].chars[0] != 0; i++)
+        ;
+    if (i == 0)
+        return 0;
+    cs->len = i;
     return 1;
 }
 
+static int lcw_winchnstr(lua_State *L)
+{
+    WINDOW *w = lcw_check(L, 1);
+    int n = luaL_checkinteger(L, 2);
+    return lc_winchnstr(L, w, n);
+}
+
 static int lcw_mvwinchnstr(lua_State *L)
 {
     WINDOW *w = lcw_check(L, 1);
@@ -1639,19 +4302,9 @@ static int lcw_mvwinchnstr(lua_State *L)
     int x = luaL_checkinteger(L, 3);
     int n = luaL_checkinteger(L, 4);
 
-    chstr *cs = chstr_new(L, n);
-
-    wchar_t *ws = malloc(sizeof(wchar_t) * n);
-    for(int i = 0; i < cs->len; i++) {
-      *ws++ = cs->str[i].chars[0];
-    }
-
-    int r = mvwins_nwstr(w, y, x, ws, n);
-    free(ws);
-    if (r == ERR)
+    if (wmove(w, y, x) == ERR)
         return 0;
-
-    return 1;
+    return lc_winchnstr(L, w, n);
 }
 
 /*
@@ -1690,6 +4343,492 @@ static int lcw_mvwinnstr(lua_State *L)
     return 1;
 }
 
+/*
+** =======================================================
+** cells
+** =======================================================
+*/
+
+/*
+** a rectangle of window cells kept as separate arrays of characters,
+** attributes and colors, read from and written to windows in one call.
+** the second cell of a wide character has character 0
+*/
+typedef struct
+{
+    int lines;
+    int cols;
+    int y;                      /* origin in the window it came from */
+    int x;
+    attr_t *attr;               /* without the color bits */
+    attr_t *color;              /* A_COLOR bits */
+    wchar_t *ch;
+} cells;
+
+static cells *lc_checkcells(lua_State *L, int index)
+{
+    return (cells*)luaL_checkudata(L, index, CELLSMETA);
+}
+
+/* index of the cell y, x or -1 */
+static int cells_index(cells *c, int y, int x)
+{
+    if (y < 0 || y >= c->lines || x < 0 || x >= c->cols)
+        return -1;
+    return y * c->cols + x;
+}
+
+/* copy the window rectangle at y, x into c, clipped. returns the cells read */
+static int cells_read(cells *c, WINDOW *w, int y, int x)
+{
+    int maxy = getmaxy(w), maxx = getmaxx(w);
+    int cy = getcury(w), cx = getcurx(w);
+    int lines = c->lines, cols = c->cols;
+    int i, j, n = 0;
+    cchar_t cc;
+
+    if (y < 0 || x < 0 || y >= maxy || x >= maxx)
+        return 0;
+    if (lines > maxy - y) lines = maxy - y;
+    if (cols > maxx - x) cols = maxx - x;
+
+    for (i = 0; i < lines; i++)
+    {
+        int k = i * c->cols;
+        for (j = 0; j < cols; j++, k++)
+        {
+            if (mvwin_wch(w, y + i, x + j, &cc) == ERR)
+                continue;
+            /* curses numbers the cells of a wide character from 1 in
+            ** the low bits of the attributes */
+            c->ch[k] = (cc.attr & A_CHARTEXT) > 1 ? 0 : cc.chars[0];
+            c->attr[k] = cc.attr & A_ATTRIBUTES & ~A_COLOR;
+            c->color[k] = cc.attr & A_COLOR;
+            n++;
+        }
+    }
+    wmove(w, cy, cx);
+    return n;
+}
+
+/*
+** cells = window:cells(y, x, lines, cols)
+** a copy of the rectangle, clipped to the window
+*/
+static int lcw_cells(lua_State *L)
+{
+    WINDOW *w = lcw_check(L, 1);
+    int y = luaL_checkinteger(L, 2);
+    int x = luaL_checkinteger(L, 3);
+    int lines = luaL_checkinteger(L, 4);
+    int cols = luaL_checkinteger(L, 5);
+    size_t n;
+    cells *c;
+
+    if (lines > getmaxy(w) - y) lines = getmaxy(w) - y;
+    if (cols > getmaxx(w) - x) cols = getmaxx(w) - x;
+    if (y < 0 || x < 0 || lines < 1 || cols < 1)
+        return 0;
+
+    n = (size_t)lines * cols;
+    c = lua_newuserdata(L, sizeof(cells) +
+        n * (2 * sizeof(attr_t) + sizeof(wchar_t)));
+    c->lines = lines;
+    c->cols = cols;
+    c->y = y;
+    c->x = x;
+    c->attr = (attr_t*)(c + 1);
+    c->color = c->attr + n;
+    c->ch = (wchar_t*)(c->color + n);
+    luaL_getmetatable(L, CELLSMETA);
+    lua_setmetatable(L, -2);
+
+    cells_read(c, w, y, x);
+    return 1;
+}
+
+/* lines, cols, y, x = cells:size() */
+static int cells_size(lua_State *L)
+{
+    cells *c = lc_checkcells(L, 1);
+    lua_pushnumber(L, c->lines);
+    lua_pushnumber(L, c->cols);
+    lua_pushnumber(L, c->y);
+    lua_pushnumber(L, c->x);
+    return 4;
+}
+
+/* ch, attr, color = cells:get(y, x) */
+static int cells_get(lua_State *L)
+{
+    cells *c = lc_checkcells(L, 1);
+    int k = cells_index(c, luaL_checkinteger(L, 2), luaL_checkinteger(L, 3));
+
+    if (k < 0)
+        return 0;
+    lua_pushnumber(L, c->ch[k]);
+    lua_pushnumber(L, c->attr[k]);
+    lua_pushnumber(L, c->color[k]);
+    return 3;
+}
+
+/*
+** cells:set(y, x, ch, [attr, [color]])
+** ch is a character code or the first character of an utf-8 string
+*/
+static int cells_set(lua_State *L)
+{
+    cells *c = lc_checkcells(L, 1);
+    int k = cells_index(c, luaL_checkinteger(L, 2), luaL_checkinteger(L, 3));
+    wchar_t ch = 0;
+
+    if (lua_type(L, 4) == LUA_TSTRING)
+    {
+        size_t len;
+        const unsigned char *s = (const unsigned char*)lua_tolstring(L, 4, &len);
+        if (len > 0 && lc_utf8_next(s, s + len, &ch) == 0)
+            luaL_argerror(L, 4, "invalid UTF-8 code");
+    }
+    else
+        ch = (wchar_t)luaL_checkinteger(L, 4);
+
+    if (k < 0)
+        return 0;
+    c->ch[k] = ch;
+    c->attr[k] = (attr_t)luaL_optnumber(L, 5, c->attr[k]) & A_ATTRIBUTES & ~A_COLOR;
+    c->color[k] = (attr_t)luaL_optnumber(L, 6, c->color[k]) & A_COLOR;
+    return 0;
+}
+
+/* str = cells:text(y): the characters of a line as an utf-8 string */
+static int cells_text(lua_State *L)
+{
+    cells *c = lc_checkcells(L, 1);
+    int y = luaL_checkinteger(L, 2);
+    wchar_t *ch;
+    char buf[4];
+    luaL_Buffer b;
+    int x;
+
+    if (y < 0 || y >= c->lines)
+        return 0;
+
+    ch = c->ch + y * c->cols;
+    luaL_buffinit(L, &b);
+    for (x = 0; x < c->cols; x++)
+        if (ch[x] != 0)
+            luaL_addlstring(&b, buf, lc_utf8_encode(buf, ch[x]));
+    luaL_pushresult(&b);
+    return 1;
+}
+
+/* n = cells:read(window, [y, [x]]): read again, from the origin by default */
+static int cells_read_lua(lua_State *L)
+{
+    cells *c = lc_checkcells(L, 1);
+    WINDOW *w = lcw_check(L, 2);
+    int y = luaL_optinteger(L, 3, c->y);
+    int x = luaL_optinteger(L, 4, c->x);
+
+    lua_pushnumber(L, cells_read(c, w, y, x));
+    return 1;
+}
+
+/*
+** n = cells:write(window, [y, [x]])
+** draw the cells back, to the origin by default, clipped to the window.
+** every run of cells up to one with character 0 is one curses call
+*/
+static int cells_write(lua_State *L)
+{
+    cells *c = lc_checkcells(L, 1);
+    WINDOW *w = lcw_check(L, 2);
+    int y = luaL_optinteger(L, 3, c->y);
+    int x = luaL_optinteger(L, 4, c->x);
+    int maxy = getmaxy(w), maxx = getmaxx(w);
+    int lines = c->lines, cols = c->cols;
+    cchar_t *run = lc_scratch(L, c->cols);
+    int i, j, n = 0;
+
+    if (y < 0 || x < 0 || y >= maxy || x >= maxx)
+    {
+        lua_pushnumber(L, 0);
+        return 1;
+    }
+    if (lines > maxy - y) lines = maxy - y;
+    if (cols > maxx - x) cols = maxx - x;
+
+    for (i = 0; i < lines; i++)
+    {
+        int k = i * c->cols;
+        for (j = 0; j < cols; )
+        {
+            int start = j, len = 0;
+            while (j < cols && c->ch[k + j] != 0)
+            {
+                memset(&run[len], 0, sizeof(cchar_t));
+                run[len].chars[0] = c->ch[k + j];
+                run[len++].attr = c->attr[k + j] | c->color[k + j];
+                j++;
+            }
+            if (len > 0 && mvwadd_wchnstr(w, y + i, x + start, run, len) != ERR)
+                n += len;
+            while (j < cols && c->ch[k + j] == 0)
+                j++;
+        }
+    }
+    lua_pushnumber(L, n);
+    return 1;
+}
+
+/*
+** n, y, x = cells:diff(other)
+** number of cells that differ from other, of the same size, and the
+** first one of them
+*/
+static int cells_diff(lua_State *L)
+{
+    cells *a = lc_checkcells(L, 1);
+    cells *b = lc_checkcells(L, 2);
+    int k, n = 0, first = -1;
+
+    luaL_argcheck(L, a->lines == b->lines && a->cols == b->cols, 2,
+        "cells of different size");
+    for (k = 0; k < a->lines * a->cols; k++)
+    {
+        if (a->ch[k] != b->ch[k] || a->attr[k] != b->attr[k] ||
+            a->color[k] != b->color[k])
+        {
+            if (first < 0)
+                first = k;
+            n++;
+        }
+    }
+
+    lua_pushnumber(L, n);
+    if (first < 0)
+        return 1;
+    lua_pushnumber(L, first / a->cols);
+    lua_pushnumber(L, first % a->cols);
+    return 3;
+}
+
+/*
+** =======================================================
+** snapshot
+** =======================================================
+*/
+
+/*
+** a snapshot is a header followed by runs of cells, row after row. a run
+** starts with its count and the attributes (with the color) of its
+** cells. a fill run, of equal cells, has the character next; a literal
+** run has the top bit of the count set and a character per cell. every
+** field is a 32 bit number in the byte order of the machine, so a
+** snapshot saved to a file can be mapped and read in place. the second
+** cell of a wide character is stored with character 0
+*/
+#define SNAPSHOT_MAGIC      0x3153434c  /* "LCS1" */
+#define SNAPSHOT_LITERAL    0x80000000u
+#define SNAPSHOT_FILL       3           /* shortest fill run */
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t lines;
+    uint32_t cols;
+    uint32_t y;                 /* cursor */
+    uint32_t x;
+    uint32_t runs;
+} snapshot_header;
+
+/* read the window cells as characters and attributes */
+static void snapshot_read(WINDOW *w, uint32_t *ch, uint32_t *attr)
+{
+    int lines = getmaxy(w), cols = getmaxx(w);
+    int y, x;
+    cchar_t cc;
+
+    for (y = 0; y < lines; y++)
+    {
+        for (x = 0; x < cols; x++, ch++, attr++)
+        {
+            *ch = *attr = 0;
+            if (mvwin_wch(w, y, x, &cc) == ERR)
+                continue;
+            *ch = (cc.attr & A_CHARTEXT) > 1 ? 0 : cc.chars[0];
+            *attr = cc.attr & A_ATTRIBUTES;
+        }
+    }
+}
+
+/* number of cells from k equal to cell k, up to n */
+static uint32_t snapshot_fill(const uint32_t *ch, const uint32_t *attr,
+                              uint32_t k, uint32_t n)
+{
+    uint32_t i = k + 1;
+    while (i < n && ch[i] == ch[k] && attr[i] == attr[k])
+        i++;
+    return i - k;
+}
+
+/*
+** blob = window:snapshot()
+** the cells and the cursor of the window as a string
+*/
+static int lcw_snapshot(lua_State *L)
+{
+    WINDOW *w = lcw_check(L, 1);
+    uint32_t n = (uint32_t)getmaxy(w) * getmaxx(w);
+    /* the cells, then the snapshot: at most a header and 3 words a cell */
+    size_t most = (2 * n + 6 + 3 * (size_t)n) * sizeof(uint32_t);
+    uint32_t *ch = (uint32_t*)lc_scratch_bytes(L, most);
+    uint32_t *attr = ch + n;
+    snapshot_header *h = (snapshot_header*)(attr + n);
+    uint32_t *p = (uint32_t*)(h + 1);
+    uint32_t k = 0;
+
+    h->magic = SNAPSHOT_MAGIC;
+    h->lines = getmaxy(w);
+    h->cols = getmaxx(w);
+    h->y = getcury(w);
+    h->x = getcurx(w);
+    h->runs = 0;
+
+    snapshot_read(w, ch, attr);
+    wmove(w, h->y, h->x);
+
+    while (k < n)
+    {
+        uint32_t fill = snapshot_fill(ch, attr, k, n);
+
+        if (fill >= SNAPSHOT_FILL)
+        {
+            *p++ = fill;
+            *p++ = attr[k];
+            *p++ = ch[k];
+            k += fill;
+        }
+        else
+        {
+            /* literal cells of the same attributes, up to a fill run */
+            uint32_t i = k + fill;
+            while (i < n && attr[i] == attr[k])
+            {
+                fill = snapshot_fill(ch, attr, i, n);
+                if (fill >= SNAPSHOT_FILL)
+                    break;
+                i += fill;
+            }
+            *p++ = (i - k) | SNAPSHOT_LITERAL;
+            *p++ = attr[k];
+            memcpy(p, ch + k, (i - k) * sizeof(uint32_t));
+            p += i - k;
+            k = i;
+        }
+        h->runs++;
+    }
+
+    lua_pushlstring(L, (const char*)h, (const char*)p - (const char*)h);
+    return 1;
+}
+
+/* draw a row of cells, a curses call per run up to a cell of character 0 */
+static int snapshot_row(WINDOW *w, int y, cchar_t *line, int cols)
+{
+    int x = 0, ok = 1;
+
+    while (x < cols)
+    {
+        int start = x;
+        while (x < cols && line[x].chars[0] != 0)
+            x++;
+        if (x > start && mvwadd_wchnstr(w, y, start, line + start, x - start) == ERR)
+            ok = 0;
+        while (x < cols && line[x].chars[0] == 0)
+            x++;
+    }
+    return ok;
+}
+
+/*
+** ok = window:restore(blob)
+** draw a snapshot back, clipped to the window, and move the cursor
+** where it was
+*/
+static int lcw_restore(lua_State *L)
+{
+    WINDOW *w = lcw_check(L, 1);
+    size_t len, words;
+    const char *s = luaL_checklstring(L, 2, &len);
+    int maxy = getmaxy(w), maxx = getmaxx(w);
+    int cols, ok = 1;
+    const uint32_t *p, *e;
+    snapshot_header h;
+    cchar_t *line;
+    uint32_t i, k = 0, n;
+
+    if (len < sizeof(h) || len % sizeof(uint32_t) != 0)
+        return luaL_argerror(L, 2, "invalid snapshot");
+    memcpy(&h, s, sizeof(h));
+    if (h.magic != SNAPSHOT_MAGIC || h.lines == 0 || h.cols == 0)
+        return luaL_argerror(L, 2, "invalid snapshot");
+
+    /*
+    ** the header sizes the row buffer and the cell count, so check it
+    ** before trusting it: each dimension must fit an int of cells, the
+    ** cell count 32 bits, and every run needs at least three words
+    */
+    words = len / sizeof(uint32_t);
+    if (h.lines > INT_MAX / sizeof(cchar_t) || h.cols > INT_MAX / sizeof(cchar_t) ||
+        (uint64_t)h.lines * h.cols > UINT32_MAX ||
+        h.runs > (words - sizeof(h) / sizeof(uint32_t)) / 3)
+        return luaL_argerror(L, 2, "invalid snapshot");
+
+    /* a copy, as the string need not be aligned */
+    p = (const uint32_t*)memcpy(lc_scratch_bytes(L, len), s, len);
+    line = lc_scratch(L, h.cols);
+    e = p + words;
+    p += sizeof(h) / sizeof(uint32_t);
+
+    n = h.lines * h.cols;
+    cols = (int)h.cols < maxx ? (int)h.cols : maxx;
+    memset(line, 0, h.cols * sizeof(cchar_t));
+    for (i = 0; i < h.runs && k < n; i++)
+    {
+        uint32_t count, attr, j;
+        int literal;
+
+        if (e - p < 3)
+            return luaL_argerror(L, 2, "invalid snapshot");
+        count = *p & ~SNAPSHOT_LITERAL;
+        literal = (*p & SNAPSHOT_LITERAL) != 0;
+        attr = p[1];
+        p += 2;
+        if (literal && (size_t)(e - p) < count)
+            return luaL_argerror(L, 2, "invalid snapshot");
+
+        for (j = 0; j < count && k < n; j++, k++)
+        {
+            uint32_t x = k % h.cols;
+            line[x].chars[0] = literal ? p[j] : *p;
+            line[x].attr = attr;
+            if (x == h.cols - 1)
+            {
+                int y = k / h.cols;
+                if (y < maxy && !snapshot_row(w, y, line, cols))
+                    ok = 0;
+            }
+        }
+        p += literal ? count : 1;
+    }
+
+    if ((int)h.y < maxy && (int)h.x < maxx)
+        wmove(w, h.y, h.x);
+    lua_pushboolean(L, ok);
+    return 1;
+}
+
 /*
 ** =======================================================
 ** insch
@@ -1782,7 +4921,7 @@ static int lcw_subpad(lua_State *L)
     int begin_y = luaL_checkinteger(L, 4);
     int begin_x = luaL_checkinteger(L, 5);
 
-    lcw_new(L, subpad(orig, nlines, ncols, begin_y, begin_x));
+    lcw_new_sub(L, subpad(orig, nlines, ncols, begin_y, begin_x), 1);
     return 1;
 }
 
@@ -1795,9 +4934,12 @@ static int lcw_prefresh(lua_State *L)
     int smincol = luaL_checkinteger(L, 5);
     int smaxrow = luaL_checkinteger(L, 6);
     int smaxcol = luaL_checkinteger(L, 7);
+    int r;
 
-    lua_pushboolean(L, B(prefresh(p, pminrow, pmincol,
-        sminrow, smincol, smaxrow, smaxcol)));
+    output_begin();
+    r = prefresh(p, pminrow, pmincol, sminrow, smincol, smaxrow, smaxcol);
+    output_end();
+    lua_pushboolean(L, B(r));
     return 1;
 }
 
@@ -1821,8 +4963,12 @@ static int lcw_pechochar(lua_State *L)
 {
     WINDOW *p = lcw_check(L, 1);
     cchar_t ch = lc_checkch(L, 2);
+    int r;
 
-    lua_pushboolean(L, B(pecho_wchar(p, &ch)));
+    output_begin();
+    r = pecho_wchar(p, &ch);
+    output_end();
+    lua_pushboolean(L, B(r));
     return 1;
 }
 
@@ -1832,33 +4978,187 @@ static int lcw_pechochar(lua_State *L)
 ** =======================================================
 */
 
-static int lcw_wattroff(lua_State *L)
+LCW_BOOLOK_INT(wattroff)
+LCW_BOOLOK_INT(wattron)
+LCW_BOOLOK_INT(wattrset)
+LCW_BOOLOK(wstandend)
+LCW_BOOLOK(wstandout)
+
+/*
+** =======================================================
+** draw batch
+** =======================================================
+*/
+
+enum
 {
-    WINDOW *w = lcw_check(L, 1);
-    int attrs = luaL_checkinteger(L, 2);
-    lua_pushboolean(L, B(wattroff(w, attrs)));
-    return 1;
+    DB_MOVE, DB_ATTRSET, DB_ATTRON, DB_ATTROFF,
+    DB_ADDCH, DB_MVADDCH, DB_ADDSTR, DB_MVADDSTR,
+    DB_ADDCHSTR, DB_MVADDCHSTR,
+    DB_HLINE, DB_VLINE, DB_MVHLINE, DB_MVVLINE,
+    DB_CLRTOEOL
+};
+
+/* command names (the window method names) and argument counts */
+static const struct
+{
+    const char *name;
+    int op;
+    int nargs;
+} draw_ops[] =
+{
+    { "move",           DB_MOVE,        2 },
+    { "attrset",        DB_ATTRSET,     1 },
+    { "attron",         DB_ATTRON,      1 },
+    { "attroff",        DB_ATTROFF,     1 },
+    { "addch",          DB_ADDCH,       1 },
+    { "mvaddch",        DB_MVADDCH,     3 },
+    { "addstr",         DB_ADDSTR,      1 },
+    { "mvaddstr",       DB_MVADDSTR,    3 },
+    { "addchstr",       DB_ADDCHSTR,    1 },
+    { "mvaddchstr",     DB_MVADDCHSTR,  3 },
+    { "hline",          DB_HLINE,       2 },
+    { "vline",          DB_VLINE,       2 },
+    { "mvhline",        DB_MVHLINE,     4 },
+    { "mvvline",        DB_MVVLINE,     4 },
+    { "clear_to_eol",   DB_CLRTOEOL,    0 },
+    { NULL, 0, 0 }
+};
+
+static int db_int(lua_State *L, int index, int cmd)
+{
+    int isnum;
+    lua_Integer v = lua_tointegerx(L, index, &isnum);
+    if (!isnum)
+        luaL_error(L, "draw_batch: number expected in command at %d", cmd);
+    return (int)v;
 }
 
-static int lcw_wattron(lua_State *L)
+static chstr *db_chstr(lua_State *L, int index, int cmd)
 {
-    WINDOW *w = lcw_check(L, 1);
-    int attrs = luaL_checkinteger(L, 2);
-    lua_pushboolean(L, B(wattron(w, attrs)));
-    return 1;
+    chstr *cs = (chstr*)luaL_testudata(L, index, CHSTRMETA);
+    if (cs == NULL)
+        luaL_error(L, "draw_batch: chstr expected in command at %d", cmd);
+    return cs;
 }
 
-static int lcw_wattrset(lua_State *L)
+/*
+** apply a list of drawing commands to the window in one call. the
+** list is flat: each command name is followed by its arguments, as
+** they would be passed to the window method of the same name
+**
+**  w:draw_batch{ 'attrset', attr, 'mvaddstr', 0, 0, 'hello',
+**                'mvhline', 1, 0, curses.ACS_HLINE, 10 }
+*/
+static int lcw_draw_batch(lua_State *L)
 {
     WINDOW *w = lcw_check(L, 1);
-    int attrs = luaL_checkinteger(L, 2);
-    lua_pushboolean(L, B(wattrset(w, attrs)));
+    int ok = 1;
+    int n, i;
+
+    luaL_checktype(L, 2, LUA_TTABLE);
+    n = (int)luaL_len(L, 2);
+
+    for (i = 1; i <= n; )
+    {
+        const char *name;
+        int k, j, a, r = OK;
+
+        lua_rawgeti(L, 2, i);
+        name = lua_tostring(L, -1);
+        if (name == NULL)
+            return luaL_error(L, "draw_batch: command name expected at %d", i);
+        for (k = 0; draw_ops[k].name; k++)
+            if (strcmp(draw_ops[k].name, name) == 0) break;
+        if (draw_ops[k].name == NULL)
+            return luaL_error(L, "draw_batch: unknown command '%s' at %d", name, i);
+
+        /* arguments end up at stack positions a .. a + nargs - 1 */
+        a = lua_gettop(L) + 1;
+        luaL_checkstack(L, draw_ops[k].nargs, "draw_batch");
+        for (j = 1; j <= draw_ops[k].nargs; j++)
+            lua_rawgeti(L, 2, i + j);
+
+        switch (draw_ops[k].op)
+        {
+        case DB_MOVE:
+            r = wmove(w, db_int(L, a, i), db_int(L, a + 1, i));
+            break;
+        case DB_ATTRSET:
+            r = wattrset(w, db_int(L, a, i));
+            break;
+        case DB_ATTRON:
+            r = wattron(w, db_int(L, a, i));
+            break;
+        case DB_ATTROFF:
+            r = wattroff(w, db_int(L, a, i));
+            break;
+        case DB_ADDCH:
+            r = waddch(w, lc_checkchtype(L, a));
+            break;
+        case DB_MVADDCH:
+            r = mvwaddch(w, db_int(L, a, i), db_int(L, a + 1, i),
+                lc_checkchtype(L, a + 2));
+            break;
+        case DB_ADDSTR:
+        {
+            size_t len;
+            const char *s = lua_tolstring(L, a, &len);
+            if (s == NULL)
+                return luaL_error(L, "draw_batch: string expected in command at %d", i);
+            r = lc_waddustr(L, w, s, len);
+            break;
+        }
+        case DB_MVADDSTR:
+        {
+            size_t len;
+            const char *s = lua_tolstring(L, a + 2, &len);
+            if (s == NULL)
+                return luaL_error(L, "draw_batch: string expected in command at %d", i);
+            r = mvwaddnstr(w, db_int(L, a, i), db_int(L, a + 1, i), s, len);
+            break;
+        }
+        case DB_ADDCHSTR:
+        {
+            chstr *cs = db_chstr(L, a, i);
+            r = wadd_wchnstr(w, cs->str, cs->len);
+            break;
+        }
+        case DB_MVADDCHSTR:
+        {
+            chstr *cs = db_chstr(L, a + 2, i);
+            r = mvwadd_wchnstr(w, db_int(L, a, i), db_int(L, a + 1, i),
+                cs->str, cs->len);
+            break;
+        }
+        case DB_HLINE:
+            r = whline(w, lc_checkchtype(L, a), db_int(L, a + 1, i));
+            break;
+        case DB_VLINE:
+            r = wvline(w, lc_checkchtype(L, a), db_int(L, a + 1, i));
+            break;
+        case DB_MVHLINE:
+            r = mvwhline(w, db_int(L, a, i), db_int(L, a + 1, i),
+                lc_checkchtype(L, a + 2), db_int(L, a + 3, i));
+            break;
+        case DB_MVVLINE:
+            r = mvwvline(w, db_int(L, a, i), db_int(L, a + 1, i),
+                lc_checkchtype(L, a + 2), db_int(L, a + 3, i));
+            break;
+        case DB_CLRTOEOL:
+            r = wclrtoeol(w);
+            break;
+        }
+
+        if (r == ERR) ok = 0;
+        lua_settop(L, 2);
+        i += 1 + draw_ops[k].nargs;
+    }
+
+    lua_pushboolean(L, ok);
     return 1;
 }
 
-LCW_BOOLOK(wstandend)
-LCW_BOOLOK(wstandout)
-
 
 /*
 ** =======================================================
@@ -1909,6 +5209,11 @@ static const luaL_Reg chstrlib[] =
     { "set_str",    chstr_set_str   },
     { "get",        chstr_get       },
     { "dup",        chstr_dup       },
+    { "set_attr",   chstr_set_attr  },
+    { "blit",       chstr_blit      },
+    { "sub",        chstr_sub       },
+    { "resize",     chstr_resize    },
+    { "clear",      chstr_clear     },
 
     { NULL, NULL }
 };
@@ -1917,6 +5222,7 @@ static const luaL_Reg windowlib[] =
 {
     /* window */
     { "close", lcw_delwin  },
+    { "resize_keep", lcw_resize_keep },
     { "sub", lcw_subwin },
     { "derive", lcw_derwin },
     { "move_window", lcw_mvwin },
@@ -1998,6 +5304,7 @@ static const luaL_Reg windowlib[] =
     { "vline", lcw_wvline },
     { "mvhline", lcw_mvwhline },
     { "mvvline", lcw_mvwvline },
+    { "draw_scrollbar", lcw_draw_scrollbar },
 
     /* addch */
     { "addch", lcw_waddch },
@@ -2012,6 +5319,9 @@ static const luaL_Reg windowlib[] =
     { "addstr", lcw_waddnstr },
     { "mvaddstr", lcw_mvwaddnstr },
 
+    /* batch */
+    { "draw_batch", lcw_draw_batch },
+
     /* bkgd */
     { "wbkgdset", lcw_wbkgdset },
     { "wbkgd", lcw_wbkgd },
@@ -2021,6 +5331,9 @@ static const luaL_Reg windowlib[] =
     { "overlay", lcw_overlay },
     { "overwrite", lcw_overwrite },
     { "copy", lcw_copywin },
+    { "copy_damaged", lcw_copy_damaged },
+    { "compose", lcw_compose },
+    { "compose_rect", lcw_compose_rect },
 
     /* delch */
     { "delch", lcw_wdelch },
@@ -2045,6 +5358,13 @@ static const luaL_Reg windowlib[] =
     { "winnstr", lcw_winnstr },
     { "mvwinnstr", lcw_mvwinnstr },
 
+    /* cells */
+    { "cells", lcw_cells },
+
+    /* snapshot */
+    { "snapshot", lcw_snapshot },
+    { "restore", lcw_restore },
+
     /* insch */
     { "winsch", lcw_winsch },
     { "mvwinsch", lcw_mvwinsch },
@@ -2055,7 +5375,48 @@ static const luaL_Reg windowlib[] =
     { "mvwinsstr", lcw_mvwinsstr },
     { "mvwinsnstr", lcw_mvwinsnstr },
 
-    /* misc */
+    {NULL, NULL}
+};
+
+/* event queue members */
+static const luaL_Reg queuelib[] =
+{
+    { "post",       queue_post_lua  },
+    { "take",       queue_take      },
+    { "len",        queue_len       },
+    { "read_keys",  queue_read_keys },
+    { "stats",      queue_stats     },
+
+    { NULL, NULL }
+};
+
+/* virtual list members */
+static const luaL_Reg vlistlib[] =
+{
+    { "draw",       vlist_draw      },
+    { "invalidate", vlist_invalidate},
+    { "stats",      vlist_stats     },
+
+    { NULL, NULL }
+};
+
+/* cells members */
+static const luaL_Reg cellslib[] =
+{
+    { "size",       cells_size      },
+    { "get",        cells_get       },
+    { "set",        cells_set       },
+    { "text",       cells_text      },
+    { "read",       cells_read_lua  },
+    { "write",      cells_write     },
+    { "diff",       cells_diff      },
+
+    { NULL, NULL }
+};
+
+/* window metamethods */
+static const luaL_Reg windowmeta[] =
+{
     {"__gc",        lcw_delwin  }, /* rough safety net */
     {"__tostring",  lcw_tostring},
     {NULL, NULL}
@@ -2067,12 +5428,30 @@ static const luaL_Reg curseslib[] =
 {
     /* chstr helper function */
     { "new_chstr",      lc_new_chstr    },
+    { "chstr_stats",    lc_chstr_stats  },
+
+    /* scratch arena */
+    { "scratch_stats",  lc_scratch_stats},
+
+    /* damage tracking */
+    { "damage_stats",   lc_damage_stats },
+
+    /* output coalescing */
+    { "output_stats",   lc_output_stats },
+
+    /* pad resizing */
+    { "resize_stats",   lc_resize_stats },
 
     /* keyboard mapping */
     { "map_keyboard",   lc_map_keyboard },
 
     /* initscr */
     { "init",           lc_initscr      },
+    { "init_headless",  lc_init_headless},
+    { "headless_input", lc_headless_input},
+    { "headless_output",lc_headless_output},
+    { "screen_line",    lc_screen_line  },
+    { "screen_cell",    lc_screen_cell  },
     { "done",           lc_endwin       },
     { "isdone",         lc_isendwin     },
     { "main_window",    lc_stdscr       },
@@ -2083,6 +5462,8 @@ static const luaL_Reg curseslib[] =
     { "start_color",    lc_start_color  },
     { "has_colors",     lc_has_colors   },
     { "init_pair",      lc_init_pair    },
+    { "make_color",     lc_make_color   },
+    { "color_stats",    lc_color_stats  },
     { "pair_content",   lc_pair_content },
     { "colors",         lc_COLORS       },
     { "color_pairs",    lc_COLOR_PAIRS  },
@@ -2101,8 +5482,25 @@ static const luaL_Reg curseslib[] =
     /* kernel */
     { "ripoffline",     lc_ripoffline   },
     { "napms",          lc_napms        },
+    { "wait_input",     lc_wait_input   },
+
+    /* keyboard */
+    { "get_key",        lc_get_key      },
+    { "get_keys",       lc_get_keys     },
+
+    /* timers */
+    { "timer_add",      lc_timer_add    },
+    { "timer_remove",   lc_timer_remove },
+    { "timer_run",      lc_timer_run    },
+    { "timer_next",     lc_timer_next   },
     { "cursor_set",     lc_curs_set     },
 
+    /* event queue */
+    { "new_queue",      lc_new_queue    },
+
+    /* virtual list */
+    { "new_vlist",      lc_new_vlist    },
+
     /* beep */
     { "beep",           lc_beep         },
     { "flash",          lc_flash        },
@@ -2168,6 +5566,8 @@ static const luaL_Reg curseslib[] =
     {"update_panels",  lc_update_panels},
     {"bottom_panel",  lc_bottom_panel},
     {"top_panel",  lc_top_panel},
+    {"panels_reorder",  lc_panels_reorder},
+    {"panels",  lc_panels},
 
     /* terminator */
     {NULL, NULL}
@@ -2175,26 +5575,19 @@ static const luaL_Reg curseslib[] =
 
 int luaopen_lcurses(lua_State *L)
 {
-
-/*
-** TODO: add upvalue table with lightuserdata keys and weak keyed
-** values containing WINDOWS and PANELS used in above functions
-*/
-
     /*
-    ** create new metatable for window objects
+    ** create new metatable for panel objects
     */
     luaL_newmetatable(L, PANELMETA);
     lua_pushvalue(L, -1);
     lua_setfield(L, -1, "__index");
-
-    luaL_newlibtable(L, panellib);
-    luaL_setfuncs(L, panellib, 1);
+    luaL_setfuncs(L, panellib, 0);
 
     /*
     ** create new metatable for window objects
     */
     luaL_newmetatable(L, WINDOWMETA);
+    luaL_setfuncs(L, windowmeta, 0);
     luaL_newlib(L, windowlib);
     lua_setfield(L, -2, "__index");
 
@@ -2202,9 +5595,52 @@ int luaopen_lcurses(lua_State *L)
     ** create new metatable for chstr objects
     */
     luaL_newmetatable(L, CHSTRMETA);
+    lua_pushcfunction(L, chstr_gc);
+    lua_setfield(L, -2, "__gc");
     luaL_newlib(L, chstrlib);
     lua_setfield(L, -2, "__index");
 
+    /*
+    ** create new metatable for event queues
+    */
+    luaL_newmetatable(L, QUEUEMETA);
+    lua_pushcfunction(L, queue_gc);
+    lua_setfield(L, -2, "__gc");
+    luaL_newlib(L, queuelib);
+    lua_setfield(L, -2, "__index");
+
+    /*
+    ** create new metatable for virtual lists
+    */
+    luaL_newmetatable(L, VLISTMETA);
+    lua_pushcfunction(L, vlist_gc);
+    lua_setfield(L, -2, "__gc");
+    luaL_newlib(L, vlistlib);
+    lua_setfield(L, -2, "__index");
+
+    /*
+    ** create new metatable for cell rectangles
+    */
+    luaL_newmetatable(L, CELLSMETA);
+    luaL_newlib(L, cellslib);
+    lua_setfield(L, -2, "__index");
+
+    /*
+    ** scratch buffer shared by the drawing functions
+    */
+    lc_newscratch(L);
+
+    /*
+    ** cell buffers of collected chstr objects
+    */
+    lc_newchstrs(L);
+    lc_newcolors(L);
+
+    /*
+    ** pending timers
+    */
+    lc_newtimers(L);
+
     luaL_newlibtable(L, curseslib);
     lua_pushvalue(L, -1);
     luaL_setfuncs(L, curseslib, 1);
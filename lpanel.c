@@ -43,7 +43,6 @@ Changes:
 ** =======================================================
 */
 #define PANELMETA           "curses:panel"
-#define UPINDEX             lua_upvalueindex(1)
 
 /* ======================================================= */
 
@@ -55,47 +54,79 @@ Changes:
         return 1;                           \
     }
 
+/*
+** a panel userdata. the curses panel points back to it through its
+** user pointer, and ref keeps the userdata in the registry while the
+** panel is open, so the panel of a PANEL* is found without a table
+** lookup. the uservalue holds the window and the data of
+** panel:set_userdata
+*/
+typedef struct
+{
+    PANEL *p;
+    int ref;
+} lpanel;
+
 /*
 ** =======================================================
 ** privates
 ** =======================================================
 */
-static void lcp_new(lua_State *L, PANEL *np)
+static void lcp_new(lua_State *L, PANEL *np, int window)
 {
-    if (np)
-    {
-        PANEL **p = lua_newuserdata(L, sizeof(PANEL*));
-        luaL_getmetatable(L, PANELMETA);
-        lua_setmetatable(L, -2);
-        *p = np;
-    }
-    else
+    lpanel *lp;
+
+    if (np == NULL)
     {
         lua_pushliteral(L, "failed to create panel");
         lua_error(L);
     }
+
+    lp = lua_newuserdata(L, sizeof(lpanel));
+    lp->p = np;
+    lp->ref = LUA_NOREF;
+    luaL_getmetatable(L, PANELMETA);
+    lua_setmetatable(L, -2);
+
+    lua_createtable(L, 2, 0);
+    lua_pushvalue(L, window);
+    lua_rawseti(L, -2, 1);
+    lua_setuservalue(L, -2);
+
+    lua_pushvalue(L, -1);
+    lp->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    set_panel_userptr(np, lp);
 }
 
-static PANEL *lcp_check(lua_State *L, int index)
+/* push the userdata of a curses panel, nil for NULL */
+static void lcp_push(lua_State *L, PANEL *p)
+{
+    lpanel *lp = p ? (lpanel*)panel_userptr(p) : NULL;
+    if (lp == NULL)
+        lua_pushnil(L);
+    else
+        lua_rawgeti(L, LUA_REGISTRYINDEX, lp->ref);
+}
+
+static lpanel *lcp_get(lua_State *L, int index)
 {
-    PANEL **p = (PANEL**)luaL_checkudata(L, 1, PANELMETA);
-    if (p == NULL) luaL_argerror(L, index, "bad curses panel");
-    if (*p == NULL) luaL_argerror(L, index, "attempt to use closed curses panel");
-    return *p;
+    lpanel *lp = (lpanel*)luaL_checkudata(L, index, PANELMETA);
+    if (lp == NULL) luaL_argerror(L, index, "bad curses panel");
+    return lp;
 }
 
-static PANEL **lcp_get(lua_State *L, int index)
+static PANEL *lcp_check(lua_State *L, int index)
 {
-    PANEL **p = (PANEL**)luaL_checkudata(L, 1, PANELMETA);
-    if (p == NULL) luaL_argerror(L, index, "bad curses panel");
-    return p;
+    lpanel *lp = lcp_get(L, index);
+    if (lp->p == NULL) luaL_argerror(L, index, "attempt to use closed curses panel");
+    return lp->p;
 }
 
 static int lcp_tostring(lua_State *L)
 {
-    PANEL **p = lcp_get(L, 1);
+    lpanel *lp = lcp_get(L, 1);
     char buff[34];
-    if (*p == NULL)
+    if (lp->p == NULL)
         strcpy(buff, "closed");
     else
         sprintf(buff, "%p", lua_touserdata(L, 1));
@@ -112,45 +143,23 @@ static int lcp_tostring(lua_State *L)
 static int lc_new_panel(lua_State *L)
 {
     WINDOW *w = lcw_check(L, 1);
-    lcp_new(L, new_panel(w));
-
-    /* save window userdata for future use if needed */
-    lua_pushlightuserdata(L, w);
-    lua_pushvalue(L, 1);
-    lua_rawset(L, UPINDEX);
-
-    /* save panel userdata for future use if needed */
-    lua_pushlightuserdata(L, *(PANEL**)lua_touserdata(L, 2));
-    lua_pushvalue(L, -2);
-    lua_rawset(L, UPINDEX);
-
+    lcp_new(L, new_panel(w), 1);
     return 1;
 }
 
 static int lcp_del_panel(lua_State *L)
 {
-    PANEL **p = lcp_get(L, 1);
-    if (*p != NULL)
+    lpanel *lp = lcp_get(L, 1);
+    if (lp->p != NULL)
     {
-        /* remove information associated with panel */
-
-        /* remove panel userdata entry */
-        lua_pushlightuserdata(L, *p);
-        lua_pushnil(L);
-        lua_rawset(L, UPINDEX);
-
-        /* remove associated window */
-        lua_pushlightuserdata(L, panel_window(*p));
-        lua_pushnil(L);
-        lua_rawset(L, UPINDEX);
+        del_panel(lp->p);
+        lp->p = NULL;
+        luaL_unref(L, LUA_REGISTRYINDEX, lp->ref);
+        lp->ref = LUA_NOREF;
 
-        /* remove panel user data entry */
-        lua_pushvalue(L, 1);
+        /* release the window and user data */
         lua_pushnil(L);
-        lua_rawset(L, UPINDEX);
-
-        del_panel(*p);
-        *p = NULL;
+        lua_setuservalue(L, 1);
     }
     return 0;
 }
@@ -182,12 +191,9 @@ static int lc_update_panels(lua_State *L)
 
 static int lcp_panel_window(lua_State *L)
 {
-    PANEL *p = lcp_check(L, 1);
-    WINDOW *w = panel_window(p);
-
-    /* get window userdata */
-    lua_pushlightuserdata(L, w);
-    lua_rawget(L, UPINDEX);
+    lcp_check(L, 1);
+    lua_getuservalue(L, 1);
+    lua_rawgeti(L, -1, 1);
     return 1;
 }
 
@@ -195,7 +201,6 @@ static int lcp_replace_panel(lua_State *L)
 {
     PANEL *p = lcp_check(L, 1);
     WINDOW *w = lcw_check(L, 2);
-    WINDOW *oldw = panel_window(p);
 
     if (replace_panel(p, w) == ERR)
     {
@@ -203,15 +208,10 @@ static int lcp_replace_panel(lua_State *L)
         return 1;
     }
 
-    /* remove entry of old window */
-    lua_pushlightuserdata(L, oldw);
-    lua_pushnil(L);
-    lua_rawset(L, UPINDEX);
-
-    /* and save new window */
-    lua_pushlightuserdata(L, oldw);
+    /* keep the new window */
+    lua_getuservalue(L, 1);
     lua_pushvalue(L, 2);
-    lua_rawset(L, UPINDEX);
+    lua_rawseti(L, -2, 1);
 
     lua_pushboolean(L, 1);
     return 1;
@@ -229,61 +229,108 @@ static int lcp_move_panel(lua_State *L)
 
 static int lc_bottom_panel(lua_State *L)
 {
-    PANEL *ap = panel_above(NULL);
-
-    /* get associated userdata variable */
-    lua_pushlightuserdata(L, ap);
-    lua_rawget(L, UPINDEX);
+    lcp_push(L, panel_above(NULL));
     return 1;
 }
 
 static int lcp_panel_above(lua_State *L)
 {
     PANEL *p = lcp_check(L, 1);
-    PANEL *ap = panel_above(p);
-
-    /* get associated userdata variable */
-    lua_pushlightuserdata(L, ap);
-    lua_rawget(L, UPINDEX);
+    lcp_push(L, panel_above(p));
     return 1;
 }
 
 static int lc_top_panel(lua_State *L)
 {
-    PANEL *bp = panel_below(NULL);
-
-    /* get associated userdata variable */
-    lua_pushlightuserdata(L, bp);
-    lua_rawget(L, UPINDEX);
+    lcp_push(L, panel_below(NULL));
     return 1;
 }
 
 static int lcp_panel_below(lua_State *L)
 {
     PANEL *p = lcp_check(L, 1);
-    PANEL *bp = panel_below(p);
+    lcp_push(L, panel_below(p));
+    return 1;
+}
+
+/*
+** ok = curses.panels_reorder{ p1, p2, ... }
+** put the panels on top of the stack, from the bottom up in the order
+** given. the other panels keep their order below them
+*/
+static int lc_panels_reorder(lua_State *L)
+{
+    lua_Integer i, n;
+    int ok = 1;
 
-    /* get associated userdata variable */
-    lua_pushlightuserdata(L, bp);
-    lua_rawget(L, UPINDEX);
+    luaL_checktype(L, 1, LUA_TTABLE);
+    n = luaL_len(L, 1);
+
+    /* check them all before the stack is changed */
+    for (i = 1; i <= n; i++)
+    {
+        lua_rawgeti(L, 1, i);
+        if (((lpanel*)luaL_testudata(L, -1, PANELMETA)) == NULL ||
+            ((lpanel*)lua_touserdata(L, -1))->p == NULL)
+            return luaL_error(L, "item %d is not an open panel", (int)i);
+        lua_pop(L, 1);
+    }
+
+    for (i = 1; i <= n; i++)
+    {
+        lua_rawgeti(L, 1, i);
+        if (top_panel(((lpanel*)lua_touserdata(L, -1))->p) == ERR)
+            ok = 0;
+        lua_pop(L, 1);
+    }
+
+    lua_pushboolean(L, ok);
     return 1;
 }
 
+/* next panel of the stack, going up, or down if the state is true */
+static int lc_panels_next(lua_State *L)
+{
+    int down = lua_toboolean(L, 1);
+    PANEL *p = NULL;
+
+    if (!lua_isnil(L, 2))
+    {
+        p = lcp_get(L, 2)->p;
+        if (p == NULL)
+            return 0;
+    }
+    lcp_push(L, down ? panel_below(p) : panel_above(p));
+    return 1;
+}
+
+/*
+** for panel in curses.panels([top_down]) do ... end
+** the panels of the stack, from the bottom up by default
+*/
+static int lc_panels(lua_State *L)
+{
+    lua_pushcfunction(L, lc_panels_next);
+    lua_pushboolean(L, lua_toboolean(L, 1));
+    lua_pushnil(L);
+    return 3;
+}
+
 static int lcp_set_panel_userptr(lua_State *L)
 {
     lcp_check(L, 1);
-    /* instead of checkinf if we have a user data value,
-    ** force it's existance without any side effects */
     lua_settop(L, 2);
-    lua_rawset(L, UPINDEX);
-    return 1;
+    lua_getuservalue(L, 1);
+    lua_pushvalue(L, 2);
+    lua_rawseti(L, -2, 2);
+    return 0;
 }
 
 static int lcp_panel_userptr(lua_State *L)
 {
     lcp_check(L, 1);
-    lua_pushvalue(L, 1);
-    lua_rawget(L, UPINDEX);
+    lua_getuservalue(L, 1);
+    lua_rawgeti(L, -1, 2);
     return 1;
 }
 